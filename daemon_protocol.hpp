@@ -0,0 +1,70 @@
+#ifndef DAEMON_PROTOCOL_HPP
+#define DAEMON_PROTOCOL_HPP
+
+#include <cstdint>
+
+/*
+ * Protocol of the tracking daemon (kcf_daemon). Clients connect to its
+ * Unix domain socket (SOCK_SEQPACKET) and send Request messages, each
+ * answered by one Reply. Frames are not sent over the socket - the
+ * client stores them in a POSIX shared memory segment (see shmem.hpp)
+ * and the request refers to it by name and offset.
+ *
+ * A stream is a sequence of frames identified by a client chosen id,
+ * objects are tracked within a stream. Requests of one stream are
+ * processed in order, objects are tracked by the daemon's worker pool.
+ *
+ * INIT        - (re)initializes the listed objects at rects in frame,
+ *               creating the stream if needed. 'config' holds options
+ *               for KCF_Config::parse().
+ * TRACK       - tracks the single object objects[0] in frame.
+ * BATCH_TRACK - tracks the listed objects (all objects of the stream if
+ *               num_objects is 0) in frame in parallel.
+ * DROP        - forgets the listed objects (the whole stream if
+ *               num_objects is 0).
+ *
+ * Object ids must not repeat within a request. When INIT fails for any
+ * object, none of the listed objects is changed.
+ */
+namespace kcfd {
+
+const uint32_t protocol_version = 1;
+const unsigned max_objects = 64;
+
+enum class Op : uint32_t { INIT = 1, TRACK = 2, BATCH_TRACK = 3, DROP = 4 };
+
+struct Frame {
+    char shm_name[64]; // shared memory segment, e.g. "/kcf-client-123"
+    uint64_t offset;   // offset of the first pixel in the segment
+    int32_t width, height;
+    int32_t type;      // OpenCV matrix type, CV_8UC3 (BGR) or CV_8UC1
+    uint32_t step;     // bytes per row
+};
+
+struct Request {
+    uint32_t version = protocol_version;
+    Op op;
+    uint32_t stream;
+    uint32_t num_objects;
+    uint32_t objects[max_objects];
+    int32_t rects[max_objects][4]; // x, y, width, height (INIT only)
+    Frame frame;
+    char config[256];              // INIT only
+};
+
+struct Box {
+    uint32_t object;
+    float cx, cy, w, h, angle;
+    float response, psr;
+};
+
+struct Reply {
+    int32_t status; // 0 on success
+    uint32_t num_boxes;
+    Box boxes[max_objects];
+    char error[128];
+};
+
+} // namespace kcfd
+
+#endif // DAEMON_PROTOCOL_HPP
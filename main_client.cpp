@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+#include "vot.hpp"
+#include "shmem.hpp"
+#include "daemon_protocol.hpp"
+
+using namespace kcfd;
+
+// Replays one VOT sequence as one stream of the daemon. With more than
+// one object, the ground truth object is tracked several times in the
+// same frame to load the daemon with batch requests.
+class Replay {
+public:
+    Replay(const std::string &socket_path, const std::string &dir, uint32_t stream, unsigned objects,
+           const std::string &config)
+        : dir(dir), stream(stream), objects(objects), config(config)
+    {
+        fd = connect_daemon(socket_path);
+    }
+    ~Replay() { close(fd); }
+
+    // Returns false on error
+    bool run();
+
+private:
+    static int connect_daemon(const std::string &path);
+    void put_frame(const cv::Mat &img, Frame &frame);
+    void call(Request &req, Reply &reply);
+
+    std::string dir;
+    uint32_t stream;
+    unsigned objects;
+    std::string config;
+    int fd;
+    SharedMemory shm;
+};
+
+int Replay::connect_daemon(const std::string &path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("Socket path too long: " + path);
+    strcpy(addr.sun_path, path.c_str());
+
+    // The daemon may still be starting
+    for (int attempt = 0; attempt < 50; ++attempt) {
+        int fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+        if (fd == -1)
+            throw std::runtime_error(std::string("socket: ") + strerror(errno));
+        if (connect(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0)
+            return fd;
+        close(fd);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    throw std::runtime_error("Cannot connect to " + path + ": " + strerror(errno));
+}
+
+void Replay::put_frame(const cv::Mat &img, Frame &frame)
+{
+    size_t size = img.total() * img.elemSize();
+    if (size > shm.size()) {
+        std::string name = "/kcf-client-" + std::to_string(getpid()) + "-" + std::to_string(stream);
+        shm = SharedMemory();
+        shm = SharedMemory::create(name, size);
+    }
+    cv::Mat dst(img.rows, img.cols, img.type(), shm.data());
+    img.copyTo(dst);
+
+    memset(&frame, 0, sizeof(frame));
+    strncpy(frame.shm_name, shm.name().c_str(), sizeof(frame.shm_name) - 1);
+    frame.offset = 0;
+    frame.width = img.cols;
+    frame.height = img.rows;
+    frame.type = img.type();
+    frame.step = uint32_t(dst.step);
+}
+
+void Replay::call(Request &req, Reply &reply)
+{
+    req.version = protocol_version;
+    req.stream = stream;
+    if (send(fd, &req, sizeof(req), MSG_NOSIGNAL) != sizeof(req))
+        throw std::runtime_error(std::string("send: ") + strerror(errno));
+    if (recv(fd, &reply, sizeof(reply), 0) != sizeof(reply))
+        throw std::runtime_error("Connection to the daemon lost");
+    if (reply.status != 0)
+        throw std::runtime_error(std::string("Daemon: ") + reply.error);
+}
+
+bool Replay::run()
+{
+    VOT vot(dir + "/groundtruth.txt", dir + "/images.txt", dir + "/output-daemon.txt");
+    cv::Rect init_rect = vot.getInitRectangle();
+    std::unique_ptr<Request> req(new Request());
+    std::unique_ptr<Reply> reply(new Reply());
+    double total_ms = 0;
+    int frames = 0;
+    char name[1024];
+
+    try {
+        while (vot.getNextFileName(name) > 0 && name[0]) {
+            cv::Mat img = cv::imread(dir + "/" + name, cv::IMREAD_COLOR);
+            if (img.empty())
+                throw std::runtime_error(std::string("Cannot read image ") + name);
+            put_frame(img, req->frame);
+
+            req->op = frames == 0 ? Op::INIT : objects == 1 ? Op::TRACK : Op::BATCH_TRACK;
+            req->num_objects = objects;
+            for (unsigned i = 0; i < objects; ++i) {
+                req->objects[i] = i;
+                req->rects[i][0] = init_rect.x;
+                req->rects[i][1] = init_rect.y;
+                req->rects[i][2] = init_rect.width;
+                req->rects[i][3] = init_rect.height;
+            }
+            strncpy(req->config, config.c_str(), sizeof(req->config) - 1);
+
+            auto start = std::chrono::steady_clock::now();
+            call(*req, *reply);
+            auto end = std::chrono::steady_clock::now();
+            if (frames > 0)
+                total_ms += std::chrono::duration<double, std::milli>(end - start).count();
+
+            const Box &b = reply->boxes[0];
+            vot.outputBoundingBox(cv::Rect(cvRound(b.cx - b.w / 2.), cvRound(b.cy - b.h / 2.),
+                                           cvRound(b.w), cvRound(b.h)));
+            frames++;
+        }
+        req->op = Op::DROP;
+        req->num_objects = 0;
+        call(*req, *reply);
+    } catch (std::exception &e) {
+        std::cerr << dir << ": " << e.what() << std::endl;
+        return false;
+    }
+
+    if (frames > 1)
+        printf("%s: %d frames, %u objects, average latency %.2f ms (%.1f fps)\n", dir.c_str(), frames, objects,
+               total_ms / (frames - 1), 1000. * (frames - 1) / total_ms);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned objects = 1;
+    std::string config;
+
+    while (1) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            {"objects",   required_argument, 0,  'n' },
+            {"config",    required_argument, 0,  'c' },
+            {"help",      no_argument,       0,  'h' },
+            {0,           0,                 0,  0 }
+        };
+
+        int c = getopt_long(argc, argv, "n:c:h", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'n':
+            objects = atoi(optarg);
+            if (objects < 1 || objects > max_objects)
+                errx(1, "Number of objects must be between 1 and %u", max_objects);
+            break;
+        case 'c':
+            if (!config.empty())
+                config += ",";
+            config += optarg;
+            break;
+        case 'h':
+            std::cerr << "Usage: \n"
+                      << argv[0] << " [options] <socket> <sequence directory>...\n"
+                      << "Replays each VOT sequence as a separate stream of kcf_daemon.\n"
+                      << "Options:\n"
+                      << " --objects | -n <objects tracked per stream>\n"
+                      << " --config  | -c <key=value[,key=value...]> (sent with INIT)\n";
+            exit(0);
+            break;
+        }
+    }
+    if (argc - optind < 2)
+        errx(1, "Socket path and at least one sequence expected, see --help");
+    if (config.size() >= sizeof(Request::config))
+        errx(1, "Configuration too long");
+
+    std::string socket_path = argv[optind];
+    std::vector<std::thread> threads;
+    std::vector<char> ok(argc - optind - 1, false);
+
+    for (int i = optind + 1; i < argc; ++i) {
+        uint32_t stream = i - optind - 1;
+        threads.emplace_back([&, i, stream]() {
+            try {
+                Replay replay(socket_path, argv[i], stream, objects, config);
+                ok[stream] = replay.run();
+            } catch (std::exception &e) {
+                std::cerr << argv[i] << ": " << e.what() << std::endl;
+            }
+        });
+    }
+    for (auto &t : threads)
+        t.join();
+
+    for (char o : ok)
+        if (!o)
+            return 1;
+    return 0;
+}
@@ -0,0 +1,369 @@
+#include <stdlib.h>
+#include <errno.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <signal.h>
+#include <err.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <cstring>
+#include <map>
+#include <set>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "kcf.h"
+#include "shmem.hpp"
+#include "worker_pool.hpp"
+#include "daemon_protocol.hpp"
+#include "metrics.h"
+
+using namespace kcfd;
+
+// Per-stream state. The mutex serializes requests of the stream.
+struct Stream {
+    std::mutex mutex;
+    std::map<uint32_t, std::unique_ptr<KCF_Tracker>> objects;
+};
+
+class Daemon {
+public:
+    Daemon(unsigned threads, const KCF_Config &config) : pool(threads), base_config(config) {}
+
+    // Serves the client connection fd from a new thread
+    void start(int fd);
+    // Closes all client connections and waits for their threads
+    void stop();
+
+private:
+    // Serves one client connection until it is closed
+    void serve(int fd);
+    void handle(const Request &req, Reply &reply, std::map<std::string, SharedMemory> &segments);
+    std::shared_ptr<Stream> stream(uint32_t id, bool create);
+    static cv::Mat frame(const Frame &f, std::map<std::string, SharedMemory> &segments);
+
+    WorkerPool pool;
+    const KCF_Config base_config;
+    std::mutex streams_mutex;
+    std::map<uint32_t, std::shared_ptr<Stream>> streams;
+
+    // Connection threads by their fd. The fds are closed after the threads
+    // are joined, so that a new connection cannot reuse the number before.
+    std::mutex connections_mutex;
+    std::map<int, std::thread> connections;
+    std::vector<int> finished; // connections whose thread has ended
+};
+
+void Daemon::start(int fd)
+{
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    for (int done : finished) {
+        connections[done].join();
+        connections.erase(done);
+        close(done);
+    }
+    finished.clear();
+    connections[fd] = std::thread(&Daemon::serve, this, fd);
+}
+
+void Daemon::stop()
+{
+    std::map<int, std::thread> threads;
+    {
+        std::lock_guard<std::mutex> lock(connections_mutex);
+        // Makes recv() in serve() return 0
+        for (auto &c : connections)
+            shutdown(c.first, SHUT_RDWR);
+        threads.swap(connections);
+        finished.clear();
+    }
+    for (auto &c : threads) {
+        c.second.join();
+        close(c.first);
+    }
+}
+
+std::shared_ptr<Stream> Daemon::stream(uint32_t id, bool create)
+{
+    std::lock_guard<std::mutex> lock(streams_mutex);
+    auto it = streams.find(id);
+    if (it != streams.end())
+        return it->second;
+    if (!create)
+        throw std::runtime_error("Unknown stream " + std::to_string(id));
+    return streams[id] = std::make_shared<Stream>();
+}
+
+// Returns the frame as a header over the shared memory. Segments stay
+// mapped for the lifetime of the connection.
+cv::Mat Daemon::frame(const Frame &f, std::map<std::string, SharedMemory> &segments)
+{
+    std::string name(f.shm_name, strnlen(f.shm_name, sizeof(f.shm_name)));
+    auto it = segments.find(name);
+    if (it == segments.end())
+        it = segments.emplace(name, SharedMemory::open(name)).first;
+
+    if (f.type != CV_8UC3 && f.type != CV_8UC1)
+        throw std::runtime_error("Unsupported frame type");
+    if (f.width <= 0 || f.height <= 0 || f.step < size_t(f.width) * CV_ELEM_SIZE(f.type))
+        throw std::runtime_error("Invalid frame geometry");
+    // The client may have grown the segment since we mapped it
+    if (f.offset + uint64_t(f.step) * f.height > it->second.size())
+        it->second = SharedMemory::open(name);
+    if (f.offset + uint64_t(f.step) * f.height > it->second.size())
+        throw std::runtime_error("Frame exceeds shared memory segment " + name);
+
+    return cv::Mat(f.height, f.width, f.type, static_cast<char *>(it->second.data()) + f.offset, f.step);
+}
+
+static Box make_box(uint32_t object, KCF_Tracker &tracker)
+{
+    BBox_c bb = tracker.getBBox();
+    Box box;
+    box.object = object;
+    box.cx = float(bb.cx);
+    box.cy = float(bb.cy);
+    box.w = float(bb.w);
+    box.h = float(bb.h);
+    box.angle = float(bb.a);
+    box.response = float(tracker.getFilterResponse());
+    box.psr = float(tracker.getPSR());
+    return box;
+}
+
+void Daemon::handle(const Request &req, Reply &reply, std::map<std::string, SharedMemory> &segments)
+{
+    if (req.version != protocol_version)
+        throw std::runtime_error("Unsupported protocol version");
+    if (req.num_objects > max_objects)
+        throw std::runtime_error("Too many objects");
+
+    if (req.op == Op::DROP) {
+        if (req.num_objects == 0) {
+            std::lock_guard<std::mutex> lock(streams_mutex);
+            streams.erase(req.stream);
+            return;
+        }
+        auto s = stream(req.stream, false);
+        std::lock_guard<std::mutex> lock(s->mutex);
+        for (uint32_t i = 0; i < req.num_objects; ++i)
+            s->objects.erase(req.objects[i]);
+        return;
+    }
+
+    // Each tracker is processed by one worker at a time
+    if (std::set<uint32_t>(req.objects, req.objects + req.num_objects).size() != req.num_objects)
+        throw std::runtime_error("Duplicate object id");
+
+    auto s = stream(req.stream, req.op == Op::INIT);
+    std::lock_guard<std::mutex> lock(s->mutex);
+    cv::Mat img = frame(req.frame, segments);
+
+    // Objects to process
+    std::vector<std::pair<uint32_t, KCF_Tracker *>> jobs;
+    // New trackers join the stream only after all of them were initialized
+    std::map<uint32_t, std::unique_ptr<KCF_Tracker>> created;
+    switch (req.op) {
+    case Op::INIT: {
+        std::string config(req.config, strnlen(req.config, sizeof(req.config)));
+        for (uint32_t i = 0; i < req.num_objects; ++i) {
+            std::unique_ptr<KCF_Tracker> tracker(new KCF_Tracker());
+            tracker->m_config = base_config;
+            tracker->m_config.parse(config);
+            jobs.emplace_back(req.objects[i], tracker.get());
+            created[req.objects[i]] = std::move(tracker);
+        }
+        break;
+    }
+    case Op::TRACK:
+    case Op::BATCH_TRACK: {
+        if (req.op == Op::TRACK && req.num_objects != 1)
+            throw std::runtime_error("TRACK needs exactly one object");
+        if (req.num_objects == 0) {
+            for (auto &it : s->objects)
+                jobs.emplace_back(it.first, it.second.get());
+        }
+        for (uint32_t i = 0; i < req.num_objects; ++i) {
+            auto it = s->objects.find(req.objects[i]);
+            if (it == s->objects.end())
+                throw std::runtime_error("Unknown object " + std::to_string(req.objects[i]));
+            jobs.emplace_back(it->first, it->second.get());
+        }
+        break;
+    }
+    default:
+        throw std::runtime_error("Unknown operation");
+    }
+
+    if (jobs.size() > max_objects)
+        throw std::runtime_error("Too many objects");
+
+    std::vector<std::future<void>> done;
+    for (uint32_t i = 0; i < jobs.size(); ++i) {
+        done.push_back(pool.submit([&, i]() {
+            KCF_Tracker &tracker = *jobs[i].second;
+            cv::UMat image = img.getUMat(cv::ACCESS_READ);
+            if (req.op == Op::INIT)
+                tracker.init(image, cv::Rect(req.rects[i][0], req.rects[i][1], req.rects[i][2], req.rects[i][3]));
+            else
+                tracker.track(image);
+            reply.boxes[i] = make_box(jobs[i].first, tracker);
+        }));
+    }
+    // Wait for all jobs before rethrowing, they refer to this frame
+    for (auto &f : done)
+        f.wait();
+    for (auto &f : done)
+        f.get();
+    for (auto &it : created)
+        s->objects[it.first] = std::move(it.second);
+    reply.num_boxes = jobs.size();
+}
+
+void Daemon::serve(int fd)
+{
+    std::map<std::string, SharedMemory> segments;
+    std::unique_ptr<Request> req(new Request);
+    std::unique_ptr<Reply> reply(new Reply);
+
+    while (true) {
+        ssize_t len = recv(fd, req.get(), sizeof(*req), 0);
+        if (len <= 0)
+            break;
+        memset(reply.get(), 0, sizeof(*reply));
+        try {
+            if (size_t(len) != sizeof(*req))
+                throw std::runtime_error("Truncated request");
+            handle(*req, *reply, segments);
+        } catch (std::exception &e) {
+            reply->status = 1;
+            reply->num_boxes = 0;
+            strncpy(reply->error, e.what(), sizeof(reply->error) - 1);
+        }
+        if (send(fd, reply.get(), sizeof(*reply), MSG_NOSIGNAL) != sizeof(*reply))
+            break;
+    }
+    std::lock_guard<std::mutex> lock(connections_mutex);
+    finished.push_back(fd);
+}
+
+// Set on SIGINT and SIGTERM. The handler also shuts the listening socket
+// down, which makes accept() fail in whichever thread got the signal.
+static volatile sig_atomic_t stop_requested = 0;
+static int listen_sock = -1;
+
+static void request_stop(int)
+{
+    stop_requested = 1;
+    shutdown(listen_sock, SHUT_RDWR);
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    KCF_Config config;
+    std::string metrics_socket;
+    // Parallelism comes from the worker pool, not from individual trackers
+    config.parallel = KCF_Config::Parallel::NONE;
+
+    while (1) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            {"threads",   required_argument, 0,  'j' },
+            {"config",    required_argument, 0,  'c' },
+            {"metrics",   required_argument, 0,  'M' },
+            {"help",      no_argument,       0,  'h' },
+            {0,           0,                 0,  0 }
+        };
+
+        int c = getopt_long(argc, argv, "j:c:M:h", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 'j':
+            if (atoi(optarg) < 1)
+                errx(1, "Invalid number of threads: %s", optarg);
+            threads = atoi(optarg);
+            break;
+        case 'c':
+            try {
+                config.parse(optarg);
+            } catch (std::runtime_error &e) {
+                errx(1, "%s", e.what());
+            }
+            break;
+        case 'M':
+            metrics_socket = optarg;
+            break;
+        case 'h':
+            std::cerr << "Usage: \n"
+                      << argv[0] << " [options] <socket>\n"
+                      << "Options:\n"
+                      << " --threads | -j <number of worker threads>\n"
+                      << " --config  | -c <key=value[,key=value...]> (defaults for all streams)\n"
+                      << " --metrics | -M <socket> (serve metrics in Prometheus format)\n";
+            exit(0);
+            break;
+        }
+    }
+    if (argc - optind != 1)
+        errx(1, "Socket path expected, see --help");
+
+    const char *path = argv[optind];
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        errx(1, "Socket path too long: %s", path);
+    strcpy(addr.sun_path, path);
+
+    int sock = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+    if (sock == -1)
+        err(1, "socket");
+    unlink(path);
+    if (bind(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1)
+        err(1, "bind(%s)", path);
+    if (listen(sock, 16) == -1)
+        err(1, "listen");
+
+    if (!metrics_socket.empty()) {
+        try {
+            MetricsRegistry::global().serve(metrics_socket);
+        } catch (std::runtime_error &e) {
+            errx(1, "%s", e.what());
+        }
+    }
+
+    listen_sock = sock;
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = request_stop;
+    sa.sa_flags = SA_RESTART; // accept() is ended by the shutdown instead
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, nullptr);
+    sigaction(SIGTERM, &sa, nullptr);
+
+    Daemon daemon(threads, config);
+    std::cout << "kcf_daemon: listening on " << path << " with " << threads << " worker threads" << std::endl;
+
+    while (!stop_requested) {
+        int fd = accept(sock, nullptr, nullptr);
+        if (fd == -1) {
+            if (stop_requested)
+                break;
+            if (errno == EINTR)
+                continue;
+            err(1, "accept");
+        }
+        daemon.start(fd);
+    }
+
+    std::cout << "kcf_daemon: stopping" << std::endl;
+    daemon.stop();
+    close(sock);
+    unlink(path);
+    return 0;
+}
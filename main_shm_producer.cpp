@@ -0,0 +1,162 @@
+#include <stdlib.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <err.h>
+#include <sys/stat.h>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <thread>
+
+#include "vot.hpp"
+#include "videoio.hpp"
+#include "shmem.hpp"
+#include "shm_ring.hpp"
+
+// Writes frames of a VOT sequence or a video file to a shared memory
+// frame ring read by 'kcf_vot shm:<name>'.
+int main(int argc, char *argv[])
+{
+    unsigned slots = 4;
+    double fps = 0;
+    bool drop = false;
+    cv::Rect init_rect;
+
+    while (1) {
+        int option_index = 0;
+        static struct option long_options[] = {
+            {"slots",     required_argument, 0,  's' },
+            {"fps",       required_argument, 0,  'r' },
+            {"drop",      no_argument,       0,  'D' },
+            {"box",       required_argument, 0,  'b' },
+            {"help",      no_argument,       0,  'h' },
+            {0,           0,                 0,  0 }
+        };
+
+        int c = getopt_long(argc, argv, "s:r:Db:h", long_options, &option_index);
+        if (c == -1)
+            break;
+
+        switch (c) {
+        case 's':
+            slots = atoi(optarg);
+            if (slots < 2)
+                errx(1, "At least two slots are needed");
+            break;
+        case 'r':
+            fps = atof(optarg);
+            break;
+        case 'D':
+            drop = true;
+            break;
+        case 'b':
+            if (sscanf(optarg, "%d,%d,%d,%d", &init_rect.x, &init_rect.y, &init_rect.width, &init_rect.height) != 4)
+                errx(1, "Invalid box specification: %s", optarg);
+            break;
+        case 'h':
+            std::cerr << "Usage: \n"
+                      << argv[0] << " [options] <name> <directory or video_file>\n"
+                      << "Options:\n"
+                      << " --slots | -s <number of frames in the ring>\n"
+                      << " --fps   | -r <frame rate> (as fast as possible by default)\n"
+                      << " --drop  | -D (drop frames when the ring is full instead of waiting)\n"
+                      << " --box   | -b <X,Y,W,H> (initial bounding box)\n";
+            exit(0);
+            break;
+        }
+    }
+    if (argc - optind != 2)
+        errx(1, "Ring name and input expected, see --help");
+
+    std::string name = argv[optind];
+    std::unique_ptr<VideoIO> io;
+    struct stat st;
+    if (stat(argv[optind + 1], &st) != 0)
+        err(1, "%s", argv[optind + 1]);
+    if (S_ISDIR(st.st_mode)) {
+        if (chdir(argv[optind + 1]) == -1)
+            err(1, "%s", argv[optind + 1]);
+        io.reset(new VOT(access("groundtruth.txt", F_OK) == 0 ? "groundtruth.txt" : "region.txt", "images.txt",
+                         "/dev/null"));
+    } else {
+        io.reset(new FileIO(argv[optind + 1]));
+    }
+
+    cv::Mat img;
+    if (io->getNextImage(img) != 1 || img.empty())
+        errx(1, "No input frames");
+    if (init_rect.width <= 0)
+        init_rect = io->getInitRectangle();
+
+    uint64_t frame_bytes = img.total() * img.elemSize();
+    uint64_t slot_size = ShmRing::slot_size_for(frame_bytes);
+    SharedMemory shm;
+    try {
+        shm = SharedMemory::create(name, ShmRing::header_size() + slots * slot_size);
+    } catch (std::runtime_error &e) {
+        errx(1, "%s", e.what());
+    }
+
+    ShmRing *ring = new (shm.data()) ShmRing;
+    ring->version = ShmRing::version_value;
+    ring->width = img.cols;
+    ring->height = img.rows;
+    ring->type = img.type();
+    ring->step = img.cols * img.elemSize();
+    ring->slots = slots;
+    ring->slot_size = slot_size;
+    ring->init_rect[0] = init_rect.x;
+    ring->init_rect[1] = init_rect.y;
+    ring->init_rect[2] = init_rect.width;
+    ring->init_rect[3] = init_rect.height;
+    ring->write_seq = ring->read_seq = ring->dropped = ring->skipped = 0;
+    ring->consumer_attached = ring->closed = 0;
+    for (unsigned i = 0; i < slots; ++i)
+        new (&ring->slot(i)) ShmRingSlot{};
+    ring->magic.store(ShmRing::magic_value, std::memory_order_release);
+
+    std::cout << "Waiting for a consumer of " << name << std::endl;
+    while (!ring->consumer_attached.load())
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    auto period = std::chrono::duration<double>(fps > 0 ? 1. / fps : 0);
+    auto next_time = std::chrono::steady_clock::now();
+    uint64_t n = 0, frames = 0;
+
+    do {
+        if (img.size() != cv::Size(ring->width, ring->height) || img.type() != ring->type)
+            errx(1, "Frame %lu has a different format than the first one", (unsigned long)frames);
+
+        while (n - ring->read_seq.load(std::memory_order_acquire) >= slots && !drop &&
+               ring->consumer_attached.load())
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+
+        if (n - ring->read_seq.load(std::memory_order_acquire) >= slots) {
+            ring->dropped.fetch_add(1);
+        } else {
+            ShmRingSlot &slot = ring->slot(n);
+            slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            slot.frame = frames;
+            img.copyTo(cv::Mat(ring->height, ring->width, ring->type, ring->pixels(n), ring->step));
+            slot.seq.store(2 * n + 2, std::memory_order_release);
+            ring->write_seq.store(++n, std::memory_order_release);
+        }
+        frames++;
+
+        if (fps > 0) {
+            next_time += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+            std::this_thread::sleep_until(next_time);
+        }
+    } while (io->getNextImage(img) == 1 && !img.empty() && ring->consumer_attached.load());
+
+    ring->closed.store(1, std::memory_order_release);
+    // Keep the segment until the consumer has read all frames
+    while (ring->consumer_attached.load() && ring->read_seq.load() < n)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+    std::cout << "Frames: " << frames << ", written: " << n << ", dropped: " << ring->dropped.load()
+              << ", skipped by consumer: " << ring->skipped.load() << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -1,57 +1,130 @@
 #include <stdlib.h>
 
-#include <trax/opencv.hpp>
+#include <trax.h>
+#include <map>
 #include <memory>
+#include <iostream>
+#include <opencv2/opencv.hpp>
 #include "kcf.h"
 
+// Converts a TraX image to a frame for the tracker. In-memory images are
+// wrapped without copying (RGB ones are converted to BGR in one pass into
+// the reused frame buffer), encoded buffers are decoded directly from the
+// message. Paths are supported as a fallback for old clients.
+static void image_to_frame(const trax::Image &img, cv::Mat &frame)
+{
+    switch (img.type()) {
+    case TRAX_IMAGE_MEMORY: {
+        int width, height, format;
+        img.get_memory_header(&width, &height, &format);
+        void *data = const_cast<char *>(img.get_memory_row(0));
+        switch (format) {
+        case TRAX_IMAGE_MEMORY_RGB:
+            cv::cvtColor(cv::Mat(height, width, CV_8UC3, data), frame, cv::COLOR_RGB2BGR);
+            break;
+        case TRAX_IMAGE_MEMORY_GRAY8:
+            frame = cv::Mat(height, width, CV_8UC1, data);
+            break;
+        case TRAX_IMAGE_MEMORY_GRAY16:
+            cv::Mat(height, width, CV_16UC1, data).convertTo(frame, CV_8U, 1. / 256);
+            break;
+        default:
+            throw std::runtime_error("Unsupported TraX memory image format");
+        }
+        break;
+    }
+    case TRAX_IMAGE_BUFFER: {
+        int length, format;
+        const char *data = img.get_buffer(&length, &format);
+        frame = cv::imdecode(cv::Mat(1, length, CV_8UC1, const_cast<char *>(data)), cv::IMREAD_COLOR);
+        break;
+    }
+    case TRAX_IMAGE_PATH:
+        frame = cv::imread(img.get_path(), cv::IMREAD_COLOR);
+        break;
+    default:
+        throw std::runtime_error("Unsupported TraX image type");
+    }
+    if (frame.empty())
+        throw std::runtime_error("Cannot decode TraX image");
+}
+
+static cv::Rect region_to_rect(const trax::Region &reg)
+{
+    float x, y, w, h;
+    reg.get(&x, &y, &w, &h);
+    return cv::Rect(cvRound(x), cvRound(y), cvRound(w), cvRound(h));
+}
+
+// Maps TraX properties to the tracker configuration. Properties named
+// "kcf.<key>" are passed to KCF_Config::set(), the use_* properties are
+// kept for compatibility with existing VOT toolkit configurations.
+static void configure(KCF_Config &cfg, const trax::Properties &prop)
+{
+    if (!prop.get("use_scale", true))
+        cfg.num_scales = 1;
+    cfg.color = prop.get("use_color", cfg.color);
+    cfg.subpixel_localization = prop.get("use_subpixel_localization", cfg.subpixel_localization);
+    cfg.subgrid_scale = prop.get("use_subgrid_scale", cfg.subgrid_scale);
+    cfg.subgrid_angle = prop.get("use_subgrid_angle", cfg.subgrid_angle);
+    cfg.cnfeat = prop.get("use_cnfeat", cfg.cnfeat);
+    if (prop.get("use_linearkernel", false))
+        cfg.kernel = KCF_Config::Kernel::LINEAR;
+
+    std::map<std::string, std::string> props;
+    prop.to_map(props);
+    for (const auto &p : props)
+        if (p.first.compare(0, 4, "kcf.") == 0)
+            cfg.set(p.first.substr(4), p.second);
+}
+
 int main()
 {
     trax::Image img;
     trax::Region reg;
 
     std::unique_ptr<KCF_Tracker> tracker;
-    cv::Mat image;
+    cv::Mat frame;
     cv::Rect rectangle;
 
-    trax::Server handle(trax::Metadata(TRAX_REGION_RECTANGLE, TRAX_IMAGE_PATH), trax_no_log);
+    trax::Server handle(trax::Metadata(TRAX_REGION_RECTANGLE, TRAX_IMAGE_MEMORY | TRAX_IMAGE_BUFFER | TRAX_IMAGE_PATH,
+                                       "kcf"),
+                        trax_no_log);
 
     while (true) {
         trax::Properties prop;
         int tr = handle.wait(img, reg, prop);
 
-        if (tr == TRAX_INITIALIZE) {
-            //create new tracker
-            tracker.reset(new KCF_Tracker());
-
-            rectangle = trax::region_to_rect(reg);
-            image = trax::image_to_mat(img);
-
-            // Dynamically configure tracker
-            tracker->m_use_scale = prop.get("use_scale", true);
-            tracker->m_use_color = prop.get("use_color", true);
-            tracker->m_use_subpixel_localization = prop.get("use_subpixel_localization", true);
-            tracker->m_use_subgrid_scale = prop.get("use_subgrid_scale", true);
-            tracker->m_use_multithreading = prop.get("use_multithreading", true);
-            tracker->m_use_cnfeat = prop.get("use_cnfeat", true);
-            tracker->m_use_linearkernel = prop.get("use_linearkernel", false);
-
-            tracker->init(image, rectangle);
-
-        } else if (tr == TRAX_FRAME) {
-
-            image = trax::image_to_mat(img);
-            if (tracker) {
-                tracker->track(image);
-                BBox_c bb = tracker->getBBox();
-                rectangle = bb.get_rect();
+        try {
+            if (tr == TRAX_INITIALIZE) {
+                tracker.reset(new KCF_Tracker());
+                configure(tracker->m_config, prop);
+                rectangle = region_to_rect(reg);
+                image_to_frame(img, frame);
+                cv::UMat image = frame.getUMat(cv::ACCESS_READ);
+                tracker->init(image, rectangle);
+            } else if (tr == TRAX_FRAME) {
+                image_to_frame(img, frame);
+                if (tracker) {
+                    cv::UMat image = frame.getUMat(cv::ACCESS_READ);
+                    tracker->track(image);
+                    rectangle = tracker->getBBox().get_rect();
+                }
+            } else {
+                break;
             }
-        } else {
-            break;
+        } catch (std::exception &e) {
+            std::cerr << "kcf_trax: " << e.what() << std::endl;
+            return EXIT_FAILURE;
         }
 
-        trax::Region status = trax::rect_to_region(rectangle);
-        handle.reply(status, trax::Properties());
-
+        trax::Properties out;
+        if (tracker) {
+            out.set("response", float(tracker->getFilterResponse()));
+            out.set("psr", float(tracker->getPSR()));
+        }
+        handle.reply(trax::Region::create_rectangle(rectangle.x, rectangle.y, rectangle.width, rectangle.height),
+                     out);
     }
 
     return EXIT_SUCCESS;
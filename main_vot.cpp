@@ -1,4 +1,5 @@
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
 #include <libgen.h>
 #include <unistd.h>
@@ -7,10 +8,17 @@
 #include <sys/stat.h>
 #include <memory>
 #include <err.h>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <thread>
 
 #include "kcf.h"
 #include "vot.hpp"
 #include "videoio.hpp"
+#include "worker_pool.hpp"
+#include "result_sink.hpp"
+#include "metrics.h"
 #include <opencv2/core/core_c.h>
 
 // Needed for OpenCV <= 3.2 as replacement for Rect::empty()
@@ -27,15 +35,13 @@ void setWindowTitle(const cv::String& winname, const cv::String& title)
 }
 #endif
 
-void writeBBox(std::string box_out, int frame_num, cv::Rect b)
+void writeBBox(std::ofstream &box_out, int frame_num, cv::Rect b)
 {
-    // TODO: Check for errors
-    FILE *f = fopen(box_out.c_str(), "a");
-    fprintf(f, "%d:%d,%d,%d,%d\n", frame_num, b.x, b.y, b.width, b.height);
-    fclose(f);
+    if (box_out.is_open())
+        box_out << frame_num << ":" << b.x << "," << b.y << "," << b.width << "," << b.height << "\n";
 }
 
-cv::Rect selectBBox(cv::Mat image, std::string box_out = "", int frame_num = 0)
+cv::Rect selectBBox(cv::Mat image, std::ofstream &box_out, int frame_num = 0)
 {
     using namespace cv;
 
@@ -90,7 +96,7 @@ cv::Rect selectBBox(cv::Mat image, std::string box_out = "", int frame_num = 0)
         key = waitKey(50);
     }
 
-    if (state.done && !box_out.empty())
+    if (state.done)
         writeBBox(box_out, frame_num, state.bbox);
 
     setWindowTitle("KCF output", "KCF output");
@@ -123,10 +129,165 @@ double calcAccuracy(std::string line, cv::Rect bb_rect, cv::Rect &groundtruth_re
     return accuracy;
 }
 
+static TrackResult makeResult(int frame, const cv::Rect &r, const KCF_Tracker *tracker = nullptr)
+{
+    TrackResult res = {};
+    res.frame = frame;
+    res.x = r.x;
+    res.y = r.y;
+    res.w = r.width;
+    res.h = r.height;
+    if (tracker) {
+        const KCF_FrameStats &stats = tracker->getFrameStats();
+        res.response = tracker->getFilterResponse();
+        res.psr = tracker->getPSR();
+        res.t_preprocess = stats.t_preprocess;
+        res.t_detect = stats.t_detect;
+        res.t_localize = stats.t_localize;
+        res.t_train = stats.t_train;
+        res.latency = stats.latency;
+    }
+    return res;
+}
+
+struct SequenceResult {
+    std::string error;
+    std::vector<double> latency; // per tracked frame in ms
+    double sum_accuracy = 0.;
+    int accuracy_frames = 0;
+};
+
+// Tracks one VOT sequence directory, storing the boxes to output.txt in it
+static void runSequence(const std::string &dir, const KCF_Config &config, int fit_size_x, int fit_size_y,
+                        SequenceResult &result)
+{
+    std::string base = dir + "/";
+    std::string region = base + (access((base + "groundtruth.txt").c_str(), F_OK) == 0 ? "groundtruth.txt"
+                                                                                        : "region.txt");
+    VOT vot(region, base + "images.txt", "", dir);
+    ResultSink sink(base + "output.txt", ResultSink::Format::VOT);
+    std::ifstream groundtruth_stream;
+    if (region == base + "groundtruth.txt") {
+        groundtruth_stream.open(region.c_str());
+        std::string line;
+        std::getline(groundtruth_stream, line);
+    }
+
+    KCF_Tracker tracker;
+    tracker.m_config = config;
+    cv::UMat image;
+    if (vot.getNextImage(image) != 1 || image.empty())
+        throw std::runtime_error("Cannot read the first image");
+    cv::Rect init_rect = vot.getInitRectangle();
+    if (empty(init_rect))
+        throw std::runtime_error("No initial bounding box");
+    sink.push(makeResult(1, init_rect));
+    tracker.init(image, init_rect, fit_size_x, fit_size_y);
+
+    while (vot.getNextImage(image) == 1) {
+        if (image.empty())
+            throw std::runtime_error("Cannot read image " + std::to_string(vot.getImageNum()));
+        auto start = std::chrono::steady_clock::now();
+        tracker.track(image);
+        auto end = std::chrono::steady_clock::now();
+        result.latency.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+
+        BBox_c bb = tracker.getBBox();
+        cv::Rect bb_rect(bb.cx - bb.w/2., bb.cy - bb.h/2., bb.w, bb.h);
+        TrackResult res = makeResult(vot.getImageNum(), bb_rect, &tracker);
+        res.angle = bb.a;
+        sink.push(res);
+
+        std::string line;
+        if (groundtruth_stream.is_open() && std::getline(groundtruth_stream, line) && !line.empty()) {
+            cv::Rect groundtruthRect;
+            result.sum_accuracy += calcAccuracy(line, bb_rect, groundtruthRect);
+            result.accuracy_frames++;
+        }
+    }
+    sink.close();
+    if (!sink.error().empty())
+        throw std::runtime_error(sink.error());
+}
+
+static double percentile(const std::vector<double> &sorted, double p)
+{
+    if (sorted.empty())
+        return 0.;
+    return sorted[std::min(sorted.size() - 1, size_t(p / 100. * sorted.size()))];
+}
+
+// Tracks all sequences listed in list_file (one directory per line)
+// concurrently and prints per-sequence results as CSV
+static int runBatch(const std::string &list_file, unsigned jobs, KCF_Config config, int fit_size_x,
+                    int fit_size_y, const std::string &output)
+{
+    std::ifstream list(list_file);
+    if (!list.is_open())
+        errx(1, "Cannot open sequence list %s", list_file.c_str());
+    std::vector<std::string> dirs;
+    for (std::string line; std::getline(list, line);)
+        if (!line.empty() && line[0] != '#')
+            dirs.push_back(line);
+
+    // Sequences already occupy all workers
+    if (jobs > 1 && config.parallel == KCF_Config::Parallel::AUTO)
+        config.parallel = KCF_Config::Parallel::NONE;
+
+    std::vector<SequenceResult> results(dirs.size());
+    std::vector<std::future<void>> done;
+    auto start = std::chrono::steady_clock::now();
+    {
+        WorkerPool pool(jobs);
+        for (size_t i = 0; i < dirs.size(); ++i)
+            done.push_back(pool.submit([&, i]() {
+                try {
+                    runSequence(dirs[i], config, fit_size_x, fit_size_y, results[i]);
+                } catch (std::exception &e) {
+                    results[i].error = e.what();
+                }
+            }));
+        for (auto &f : done)
+            f.get();
+    }
+    double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    FILE *out = output.empty() ? stdout : fopen(output.c_str(), "w");
+    if (!out)
+        err(1, "%s", output.c_str());
+    fprintf(out, "sequence,frames,fps,latency_mean_ms,latency_p50_ms,latency_p90_ms,latency_p99_ms,latency_max_ms,"
+                 "mean_iou,error\n");
+    size_t total_frames = 0;
+    int failed = 0;
+    for (size_t i = 0; i < dirs.size(); ++i) {
+        std::vector<double> &lat = results[i].latency;
+        std::sort(lat.begin(), lat.end());
+        double sum = 0.;
+        for (double l : lat)
+            sum += l;
+        double mean = lat.empty() ? 0. : sum / lat.size();
+        fprintf(out, "%s,%zu,%.2f,%.3f,%.3f,%.3f,%.3f,%.3f,", dirs[i].c_str(), lat.size(),
+                mean > 0 ? 1000. / mean : 0., mean, percentile(lat, 50), percentile(lat, 90), percentile(lat, 99),
+                lat.empty() ? 0. : lat.back());
+        if (results[i].accuracy_frames)
+            fprintf(out, "%.4f", results[i].sum_accuracy / results[i].accuracy_frames);
+        fprintf(out, ",%s\n", results[i].error.c_str());
+        total_frames += lat.size();
+        failed += !results[i].error.empty();
+    }
+    if (out != stdout)
+        fclose(out);
+    fprintf(stderr, "%zu sequences (%d failed), %zu frames in %.2f s (%.1f fps) with %u jobs\n", dirs.size(),
+            failed, total_frames, wall_s, total_frames / wall_s, jobs);
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
 int main(int argc, char *argv[])
 {
     //load region, images and prepare for output
-    std::string region, images, output, video_out, box_out;
+    std::string region, images, output, video_out, box_out, batch, metrics, record;
+    ResultSink::Format output_format = ResultSink::Format::VOT;
+    unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
     int visualize_delay = -1, fit_size_x = -1, fit_size_y = -1;
     KCF_Tracker tracker;
     cv::VideoWriter videoWriter;
@@ -141,15 +302,21 @@ int main(int argc, char *argv[])
             {"visual_debug", optional_argument,    0, 'p'},
             {"help",      no_argument,       0,  'h' },
             {"output",    required_argument, 0,  'o' },
+            {"format",    required_argument, 0,  'F' },
             {"video_out", optional_argument, 0,  'O' },
             {"visualize", optional_argument, 0,  'v' },
             {"fit",       optional_argument, 0,  'f' },
             {"box",       optional_argument, 0,  'b' },
             {"box_out",   required_argument, 0,  'B' },
+            {"config",    required_argument, 0,  'c' },
+            {"batch",     required_argument, 0,  'L' },
+            {"jobs",      required_argument, 0,  'j' },
+            {"metrics",   required_argument, 0,  'M' },
+            {"record",    required_argument, 0,  'R' },
             {0,           0,                 0,  0 }
         };
 
-        int c = getopt_long(argc, argv, "b::B:dp::hv::f::o:O::", long_options, &option_index);
+        int c = getopt_long(argc, argv, "b::B:c:dp::hv::f::o:F:O::L:j:M:R:", long_options, &option_index);
         if (c == -1)
             break;
 
@@ -165,6 +332,13 @@ int main(int argc, char *argv[])
         case 'B':
             box_out = optarg;
             break;
+        case 'c':
+            try {
+                tracker.m_config.parse(optarg);
+            } catch (std::runtime_error &e) {
+                errx(1, "%s", e.what());
+            }
+            break;
         case 'd':
             tracker.m_debug = true;
             break;
@@ -183,21 +357,50 @@ int main(int argc, char *argv[])
                       << argv[0] << " [options]\n"
                       << argv[0] << " [options] <directory>\n"
                       << argv[0] << " [options] <video_file>\n"
+                      << argv[0] << " [options] shm:</ring_name>[,latest]\n"
+                      << argv[0] << " [options] replay:<recording>\n"
                       << argv[0] << " [options] <path/to/region.txt or groundtruth.txt> <path/to/images.txt> [path/to/output.txt]\n"
                       << "Options:\n"
                       << " --visualize    | -v[delay_ms]\n"
                       << " --output       | -o <output.txt>\n"
+                      << " --format       | -F <vot|csv|binary>\n"
                       << " --video_out    | -O <filename>\n"
                       << " --fit          | -f[W[xH]]\n"
                       << " --debug        | -d\n"
                       << " --visual_debug | -p [p|r]\n"
                       << " --box          | -b [X,Y,W,H]\n"
-                      << " --box_out      | -B <filename>\n";
+                      << " --box_out      | -B <filename>\n"
+                      << " --config       | -c <key=value[,key=value...]>\n"
+                      << " --batch        | -L <file with list of sequence directories>\n"
+                      << " --jobs         | -j <number of sequences tracked concurrently with --batch>\n"
+                      << " --metrics      | -M <metrics.prom>\n"
+                      << " --record       | -R <recording>\n";
             exit(0);
             break;
         case 'o':
             output = optarg;
             break;
+        case 'F':
+            try {
+                output_format = ResultSink::parseFormat(optarg);
+            } catch (std::runtime_error &e) {
+                errx(1, "%s", e.what());
+            }
+            break;
+        case 'L':
+            batch = optarg;
+            break;
+        case 'M':
+            metrics = optarg;
+            break;
+        case 'R':
+            record = optarg;
+            break;
+        case 'j':
+            jobs = atoi(optarg);
+            if (jobs < 1)
+                errx(1, "Invalid number of jobs: %s", optarg);
+            break;
         case 'O':
             video_out = optarg ? optarg : "./output.avi";
             break;
@@ -220,10 +423,41 @@ int main(int argc, char *argv[])
         }
     }
 
+    if (!batch.empty()) {
+        if (argc - optind != 0)
+            errx(1, "No positional arguments allowed with --batch");
+        int ret = runBatch(batch, jobs, tracker.m_config, fit_size_x, fit_size_y, output);
+        try {
+            if (!metrics.empty())
+                MetricsRegistry::global().write_prometheus(metrics);
+        } catch (std::runtime_error &e) {
+            errx(1, "%s", e.what());
+        }
+        return ret;
+    }
+
     std::unique_ptr<VideoIO> io;
 
     switch (argc - optind) {
     case 1:
+        if (strncmp(argv[optind], "shm:", 4) == 0) { // Frame ring written by kcf_shm_producer
+            std::string name = argv[optind] + 4;
+            bool latest = name.size() > 7 && name.compare(name.size() - 7, 7, ",latest") == 0;
+            try {
+                io.reset(new ShmIO(latest ? name.substr(0, name.size() - 7) : name, latest));
+            } catch (std::runtime_error &e) {
+                errx(1, "%s", e.what());
+            }
+            break;
+        }
+        if (strncmp(argv[optind], "replay:", 7) == 0) { // Tracker inputs recorded with --record
+            try {
+                io.reset(new ReplayIO(argv[optind] + 7));
+            } catch (std::runtime_error &e) {
+                errx(1, "%s", e.what());
+            }
+            break;
+        }
         try { // If the argument is a number, try openning the camera first
             io.reset(new FileIO(std::stoi(argv[optind])));
             break;
@@ -271,7 +505,32 @@ int main(int argc, char *argv[])
     }
 
     if (!io)
-        io.reset(new VOT(region, images, output));
+        io.reset(new VOT(region, images, ""));
+
+    std::unique_ptr<ResultSink> sink;
+    if (!output.empty()) {
+        try {
+            sink.reset(new ResultSink(output, output_format));
+        } catch (std::runtime_error &e) {
+            errx(1, "%s", e.what());
+        }
+    }
+
+    std::unique_ptr<Recorder> recorder;
+    if (!record.empty()) {
+        try {
+            recorder.reset(new Recorder(record));
+        } catch (std::runtime_error &e) {
+            errx(1, "%s", e.what());
+        }
+    }
+
+    std::ofstream box_stream;
+    if (!box_out.empty()) {
+        box_stream.open(box_out, std::ios::app);
+        if (!box_stream.is_open())
+            err(1, "%s", box_out.c_str());
+    }
 
     // if groundtruth.txt is used use intersection over union (IOU) to calculate tracker accuracy
     std::ifstream groundtruth_stream;
@@ -289,13 +548,14 @@ int main(int argc, char *argv[])
         init_rect = io->getInitRectangle(); // Try to get BBox from VOT or .txt files
 
     if (empty(init_rect) || set_box_interactively) {
-        init_rect = selectBBox(image.getMat(cv::ACCESS_RW), box_out, 1);
+        init_rect = selectBBox(image.getMat(cv::ACCESS_RW), box_stream, 1);
         auto b = init_rect;
         printf("--box=%d,%d,%d,%d\n", b.x, b.y, b.width, b.height);
         if (visualize_delay < 0)
             cv::destroyWindow("KCF output");
     }
-    io->outputBoundingBox(init_rect);
+    if (sink)
+        sink->push(makeResult(1, init_rect));
 
     if (!video_out.empty()) {
         int codec = cv::VideoWriter::fourcc('M', 'J', 'P', 'G');  // select desired codec (must be available at runtime)
@@ -304,6 +564,8 @@ int main(int argc, char *argv[])
     }
 
     tracker.init(image, init_rect, fit_size_x, fit_size_y);
+    if (recorder)
+        recorder->add(1, image.getMat(cv::ACCESS_READ), init_rect, tracker.getReadRegion());
 
     BBox_c bb;
     cv::Rect bb_rect;
@@ -323,16 +585,24 @@ int main(int argc, char *argv[])
             do_track = true;
             tracker.init(image, init_rect, fit_size_x, fit_size_y);
         }
+        // Before anything is drawn into the image. Interactive
+        // re-initialization below is not recorded.
+        if (recorder)
+            recorder->add(io->getImageNum(), image.getMat(cv::ACCESS_READ), init_rect, tracker.getReadRegion());
 
         time_profile_counter = cv::getCPUTickCount() - time_profile_counter;
         std::cout << io->getImageNum() << "  -> speed : " <<  time_profile_counter/((double)cvGetTickFrequency()*1000) << "ms per frame, "
-                      "response : " << tracker.getFilterResponse();
+                      "response : " << tracker.getFilterResponse() << ", PSR : " << tracker.getPSR();
         avg_time += time_profile_counter/((double)cvGetTickFrequency()*1000);
         frames++;
 
         bb = tracker.getBBox();
         bb_rect = cv::Rect(bb.cx - bb.w/2., bb.cy - bb.h/2., bb.w, bb.h);
-        io->outputBoundingBox(bb_rect);
+        if (sink) {
+            TrackResult res = makeResult(io->getImageNum(), bb_rect, &tracker);
+            res.angle = bb.a;
+            sink->push(res);
+        }
 
         if (groundtruth_stream.is_open()) {
             std::string line;
@@ -346,7 +616,7 @@ int main(int argc, char *argv[])
             sum_accuracy += accuracy;
         }
 
-        std::cout << std::endl;
+        std::cout << "\n";
 
         if (visualize_delay >= 0 || !video_out.empty()) {
             cv::Point pt(bb.cx, bb.cy);
@@ -367,13 +637,13 @@ int main(int argc, char *argv[])
                     break;
                 switch (key) {
                 case 'i':
-                    init_rect = selectBBox(image.getMat(cv::ACCESS_RW), box_out, io->getImageNum());
+                    init_rect = selectBBox(image.getMat(cv::ACCESS_RW), box_stream, io->getImageNum());
                     tracker.init(image, init_rect, fit_size_x, fit_size_y);
                     break;
                 case 'o':
                     // switch tracker off
                     do_track = false;
-                    writeBBox(box_out, io->getImageNum(), cv::Rect(-1,-1,-1,-1));
+                    writeBBox(box_stream, io->getImageNum(), cv::Rect(-1,-1,-1,-1));
                     break;
                 }
             }
@@ -407,9 +677,26 @@ int main(int argc, char *argv[])
         std::cout << "; Average accuracy: " << sum_accuracy/frames << std::endl;
         groundtruth_stream.close();
     }
+    if (sink) {
+        sink->close();
+        if (sink->dropped())
+            std::cout << "; Results dropped by slow output: " << sink->dropped();
+    }
+    if (auto shm = dynamic_cast<ShmIO *>(io.get()))
+        std::cout << "; Frames dropped by producer: " << shm->getDropped() << ", skipped: " << shm->getSkipped();
     if (!video_out.empty())
        videoWriter.release();
     std::cout << std::endl;
 
+    if (!metrics.empty()) {
+        try {
+            MetricsRegistry::global().write_prometheus(metrics);
+        } catch (std::runtime_error &e) {
+            errx(1, "%s", e.what());
+        }
+    }
+    if (sink && !sink->error().empty())
+        errx(1, "%s", sink->error().c_str());
+
     return EXIT_SUCCESS;
 }
@@ -0,0 +1,177 @@
+"""Python bindings of the KCF tracker.
+
+The bindings call the C interface of libkcf_c (see src/kcf_c.h) through
+ctypes. Frames are NumPy arrays (or other objects supporting the buffer
+protocol) of type uint8 with shape (height, width) for gray or
+(height, width, 3 or 4) for BGR(A) images. Their pixels are passed to
+the tracker without copying as long as each row is packed, which holds
+for arrays returned by OpenCV and for any slices of rows. ctypes
+releases the GIL for the duration of each call, so other Python threads
+run while the tracker works.
+
+The library is searched for in the path given by the KCF_C_LIBRARY
+environment variable, then in the build directories next to this file
+and finally in the system library path.
+"""
+
+import ctypes
+import ctypes.util
+import glob
+import os
+from collections import namedtuple
+
+import numpy as np
+
+PIXEL_BGR8 = 0
+PIXEL_RGB8 = 1
+PIXEL_GRAY8 = 2
+PIXEL_BGRA8 = 3
+
+BBox = namedtuple("BBox", "cx cy w h angle")
+Result = namedtuple("Result", "bbox response psr")
+
+
+class _Frame(ctypes.Structure):
+    _fields_ = [("data", ctypes.c_void_p),
+                ("width", ctypes.c_int32),
+                ("height", ctypes.c_int32),
+                ("stride", ctypes.c_int64),
+                ("format", ctypes.c_int32)]
+
+
+class _Result(ctypes.Structure):
+    _fields_ = [("cx", ctypes.c_float),
+                ("cy", ctypes.c_float),
+                ("w", ctypes.c_float),
+                ("h", ctypes.c_float),
+                ("angle", ctypes.c_float),
+                ("response", ctypes.c_float),
+                ("psr", ctypes.c_float),
+                ("status", ctypes.c_int32)]
+
+    def to_result(self):
+        return Result(BBox(self.cx, self.cy, self.w, self.h, self.angle), self.response, self.psr)
+
+
+def _find_library():
+    path = os.environ.get("KCF_C_LIBRARY")
+    if path:
+        return path
+    top = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+    candidates = sorted(glob.glob(os.path.join(top, "build*", "src", "libkcf_c.so")), key=os.path.getmtime)
+    if candidates:
+        return candidates[-1]  # the most recently built one
+    path = ctypes.util.find_library("kcf_c")
+    if path:
+        return path
+    raise OSError("libkcf_c not found, set KCF_C_LIBRARY")
+
+
+_lib = ctypes.CDLL(_find_library())
+_lib.kcf_api_version.restype = ctypes.c_int
+_lib.kcf_last_error.restype = ctypes.c_char_p
+_lib.kcf_create.restype = ctypes.c_void_p
+_lib.kcf_create.argtypes = [ctypes.c_char_p]
+_lib.kcf_destroy.argtypes = [ctypes.c_void_p]
+_lib.kcf_init.argtypes = [ctypes.c_void_p, ctypes.POINTER(_Frame)] + [ctypes.c_int] * 4
+_lib.kcf_track.argtypes = [ctypes.c_void_p, ctypes.POINTER(_Frame), ctypes.POINTER(_Result)]
+_lib.kcf_get_result.argtypes = [ctypes.c_void_p, ctypes.POINTER(_Result)]
+_lib.kcf_last_latency_ms.restype = ctypes.c_double
+_lib.kcf_last_latency_ms.argtypes = [ctypes.c_void_p]
+_lib.kcf_track_many.argtypes = [ctypes.POINTER(_Frame), ctypes.POINTER(ctypes.c_void_p), ctypes.c_int,
+                                ctypes.POINTER(_Result)]
+
+if _lib.kcf_api_version() != 1:
+    raise ImportError("Unsupported libkcf_c API version %d" % _lib.kcf_api_version())
+
+
+class KCFError(RuntimeError):
+    pass
+
+
+def _check(ret):
+    if ret != 0:
+        raise KCFError(_lib.kcf_last_error().decode())
+
+
+def _frame(image, rgb=False):
+    """Returns the frame descriptor and the array that must be kept alive during the call."""
+    a = np.asarray(image)
+    if a.dtype != np.uint8:
+        raise TypeError("Frames must be of type uint8")
+    if a.ndim == 2:
+        fmt = PIXEL_GRAY8
+    elif a.ndim == 3 and a.shape[2] == 3:
+        fmt = PIXEL_RGB8 if rgb else PIXEL_BGR8
+    elif a.ndim == 3 and a.shape[2] == 4 and not rgb:
+        fmt = PIXEL_BGRA8
+    else:
+        raise ValueError("Unsupported frame shape %s" % (a.shape,))
+    # The C API needs packed pixels within a row and a positive row stride
+    if a.strides[-1] != 1 or (a.ndim == 3 and a.strides[1] != a.shape[2]) or a.strides[0] <= 0:
+        a = np.ascontiguousarray(a)
+    return _Frame(a.ctypes.data, a.shape[1], a.shape[0], a.strides[0], fmt), a
+
+
+class Tracker:
+    """Tracker of a single object, see KCF_Tracker.
+
+    config is a string of "key=value,..." options (see README.md).
+    """
+
+    def __init__(self, config=None):
+        self._handle = _lib.kcf_create(config.encode() if config else None)
+        if not self._handle:
+            raise KCFError(_lib.kcf_last_error().decode())
+
+    def __del__(self):
+        self.close()
+
+    def close(self):
+        if getattr(self, "_handle", None):
+            _lib.kcf_destroy(self._handle)
+            self._handle = None
+
+    def init(self, image, bbox, rgb=False):
+        """Starts tracking the object at bbox = (x, y, width, height)."""
+        frame, keep = _frame(image, rgb)
+        x, y, w, h = (int(v) for v in bbox)
+        _check(_lib.kcf_init(self._handle, ctypes.byref(frame), x, y, w, h))
+
+    def track(self, image, rgb=False):
+        """Tracks the object in the next frame and returns its Result."""
+        frame, keep = _frame(image, rgb)
+        res = _Result()
+        _check(_lib.kcf_track(self._handle, ctypes.byref(frame), ctypes.byref(res)))
+        return res.to_result()
+
+    def result(self):
+        res = _Result()
+        _check(_lib.kcf_get_result(self._handle, ctypes.byref(res)))
+        return res.to_result()
+
+    def get_bbox(self):
+        return self.result().bbox
+
+    @property
+    def response(self):
+        return self.result().response
+
+    @property
+    def psr(self):
+        return self.result().psr
+
+    @property
+    def last_latency_ms(self):
+        """Duration of the last track() inside the native tracker."""
+        return _lib.kcf_last_latency_ms(self._handle)
+
+
+def track_many(image, trackers, rgb=False):
+    """Tracks all trackers in the same frame in parallel; returns a list of Results."""
+    frame, keep = _frame(image, rgb)
+    n = len(trackers)
+    handles = (ctypes.c_void_p * n)(*(t._handle for t in trackers))
+    results = (_Result * n)()
+    _check(_lib.kcf_track_many(ctypes.byref(frame), handles, n, results))
+    return [r.to_result() for r in results]
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""Measures the overhead of the Python bindings.
+
+Tracks the object of a VOT sequence directory and compares the time of
+each Python call with the time spent in the native tracker
+(KCF_Tracker::track). With --objects N, the object is additionally
+tracked N times per frame by a single track_many() call.
+
+Usage: kcf_bench.py [--objects N] [--config key=value,...] <sequence directory>
+"""
+
+import argparse
+import os
+import time
+
+import cv2
+import numpy as np
+
+import kcf
+
+
+def read_sequence(path):
+    with open(os.path.join(path, "images.txt")) as f:
+        names = [line.strip() for line in f if line.strip()]
+    with open(os.path.join(path, "groundtruth.txt")) as f:
+        v = [float(x) for x in f.readline().split(",")]
+    xs, ys = v[0::2], v[1::2]
+    if len(v) == 4:
+        bbox = v
+    else:
+        bbox = (min(xs), min(ys), max(xs) - min(xs), max(ys) - min(ys))
+    frames = [cv2.imread(os.path.join(path, n), cv2.IMREAD_COLOR) for n in names]
+    return frames, bbox
+
+
+def stats(name, values):
+    v = np.array(values)
+    print("%-28s mean %8.3f ms  p50 %8.3f ms  p99 %8.3f ms" %
+          (name, v.mean(), np.percentile(v, 50), np.percentile(v, 99)))
+
+
+def main():
+    parser = argparse.ArgumentParser()
+    parser.add_argument("sequence")
+    parser.add_argument("--objects", "-n", type=int, default=0)
+    parser.add_argument("--config", "-c", default=None)
+    args = parser.parse_args()
+
+    # Decode all frames first so that the measurement does not include I/O
+    frames, bbox = read_sequence(args.sequence)
+
+    tracker = kcf.Tracker(args.config)
+    tracker.init(frames[0], bbox)
+    call, native = [], []
+    for frame in frames[1:]:
+        start = time.perf_counter()
+        tracker.track(frame)
+        call.append((time.perf_counter() - start) * 1000)
+        native.append(tracker.last_latency_ms)
+    print("%s: %d frames" % (args.sequence, len(frames) - 1))
+    stats("Python track()", call)
+    stats("native track()", native)
+    stats("overhead per call", np.array(call) - np.array(native))
+
+    if args.objects > 0:
+        trackers = [kcf.Tracker(args.config) for _ in range(args.objects)]
+        for t in trackers:
+            t.init(frames[0], bbox)
+        batch = []
+        for frame in frames[1:]:
+            start = time.perf_counter()
+            kcf.track_many(frame, trackers)
+            batch.append((time.perf_counter() - start) * 1000)
+        stats("track_many() of %d objects" % args.objects, batch)
+        stats("  per object", np.array(batch) / args.objects)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,124 @@
+#ifndef RECORDING_HPP
+#define RECORDING_HPP
+
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+/*
+ * Recording of tracker inputs for benchmarking without video decoding
+ * (kcf_vot --record, replayed by ReplayIO). For each frame, only the part
+ * of the image read by the tracker (KCF_Tracker::getReadRegion()) is
+ * stored, so that replay with the same tracker configuration gives the
+ * same results as the live run.
+ *
+ * File layout (native byte order):
+ *   RecordingHeader
+ *   chunks of up to frames_per_chunk frames:
+ *     RecordingChunk
+ *     'frames' times: RecordingFrame followed by the crop pixels
+ *                     (crop[2] * crop[3] pixels, rows packed)
+ */
+struct RecordingHeader {
+    char magic[8];           // "KCFREC1"
+    int32_t width, height;   // size of the frames
+    int32_t type;            // OpenCV matrix type of the frames
+    uint32_t frames_per_chunk;
+};
+
+struct RecordingChunk {
+    static const uint32_t magic_value = 0x4b4e4843; // "CHNK"
+    uint32_t magic;
+    uint32_t frames;
+    uint64_t bytes;          // size of the frame records that follow
+};
+
+struct RecordingFrame {
+    int32_t frame;           // frame number of the live run
+    int32_t init[4];         // x, y, width, height of the (re)initialization rectangle, zero width if none
+    int32_t crop[4];         // x, y, width, height of the stored pixels
+};
+
+class Recorder {
+public:
+    Recorder(const std::string &file, unsigned frames_per_chunk = 64)
+        : m_frames_per_chunk(frames_per_chunk)
+    {
+        m_file = fopen(file.c_str(), "wb");
+        if (!m_file)
+            throw std::runtime_error("Cannot open " + file + ": " + strerror(errno));
+    }
+
+    ~Recorder()
+    {
+        try {
+            flush();
+        } catch (std::runtime_error &e) {
+            std::cerr << e.what() << std::endl;
+        }
+        fclose(m_file);
+    }
+
+    // Stores the crop of img; init is the rectangle the tracker was
+    // (re)initialized with in this frame, empty if it only tracked
+    void add(int frame, const cv::Mat &img, const cv::Rect &init, cv::Rect crop)
+    {
+        if (!m_header_written) {
+            RecordingHeader h = {};
+            strcpy(h.magic, "KCFREC1");
+            h.width = img.cols;
+            h.height = img.rows;
+            h.type = img.type();
+            h.frames_per_chunk = m_frames_per_chunk;
+            m_header = h;
+            if (fwrite(&h, sizeof(h), 1, m_file) != 1)
+                throw std::runtime_error("Cannot write recording");
+            m_header_written = true;
+        }
+        if (img.cols != m_header.width || img.rows != m_header.height || img.type() != m_header.type)
+            throw std::runtime_error("Cannot record frames of different formats");
+
+        crop &= cv::Rect(0, 0, img.cols, img.rows);
+        RecordingFrame f = {frame, {init.x, init.y, init.width, init.height},
+                            {crop.x, crop.y, crop.width, crop.height}};
+        append(&f, sizeof(f));
+        for (int y = crop.y; y < crop.y + crop.height; ++y)
+            append(img.ptr(y, crop.x), crop.width * img.elemSize());
+
+        if (++m_chunk_frames == m_frames_per_chunk)
+            flush();
+    }
+
+private:
+    void append(const void *data, size_t size)
+    {
+        const char *p = static_cast<const char *>(data);
+        m_chunk.insert(m_chunk.end(), p, p + size);
+    }
+
+    void flush()
+    {
+        if (m_chunk_frames == 0)
+            return;
+        RecordingChunk c = {RecordingChunk::magic_value, m_chunk_frames, m_chunk.size()};
+        if (fwrite(&c, sizeof(c), 1, m_file) != 1 || fwrite(m_chunk.data(), 1, m_chunk.size(), m_file) != m_chunk.size())
+            throw std::runtime_error("Cannot write recording");
+        m_chunk.clear();
+        m_chunk_frames = 0;
+    }
+
+    FILE *m_file;
+    unsigned m_frames_per_chunk;
+    unsigned m_chunk_frames = 0;
+    std::vector<char> m_chunk;
+    RecordingHeader m_header;
+    bool m_header_written = false;
+};
+
+#endif // RECORDING_HPP
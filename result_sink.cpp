@@ -0,0 +1,146 @@
+#include "result_sink.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+ResultSink::ResultSink(const std::string &file, Format format, size_t queue_limit)
+    : m_format(format), m_queue_limit(queue_limit)
+{
+    m_file = fopen(file.c_str(), format == Format::BINARY ? "wb" : "w");
+    if (!m_file)
+        throw std::runtime_error("Cannot open output file " + file + ": " + strerror(errno));
+    setvbuf(m_file, nullptr, _IOFBF, 1 << 16);
+
+    if (format == Format::CSV) {
+        fputs("frame,x,y,w,h,angle,response,psr,t_preprocess_ms,t_detect_ms,t_localize_ms,t_train_ms,latency_ms\n",
+              m_file);
+    } else if (format == Format::BINARY) {
+        uint32_t header[3] = {binary_magic, binary_version, uint32_t(sizeof(TrackResult))};
+        if (fwrite(header, sizeof(header), 1, m_file) != 1)
+            fail("write");
+    }
+    m_writer = std::thread(&ResultSink::run, this);
+}
+
+ResultSink::~ResultSink()
+{
+    close();
+}
+
+void ResultSink::close()
+{
+    if (m_closed)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_one();
+    m_writer.join();
+    if (fclose(m_file) != 0)
+        fail("close");
+    m_closed = true;
+}
+
+void ResultSink::push(const TrackResult &result)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_queue.size() >= m_queue_limit) {
+            m_dropped++;
+            if (m_format == Format::VOT) {
+                if (m_gaps.empty() || m_gaps.back().first != m_queue.size())
+                    m_gaps.emplace_back(m_queue.size(), 0);
+                m_gaps.back().second++;
+            }
+            return;
+        }
+        m_queue.push_back(result);
+    }
+    m_cond.notify_one();
+}
+
+uint64_t ResultSink::dropped() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dropped;
+}
+
+std::string ResultSink::error() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_error;
+}
+
+void ResultSink::fail(const char *what)
+{
+    std::string msg = std::string("Cannot ") + what + " results: " + strerror(errno);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_error.empty())
+        m_error = msg;
+}
+
+ResultSink::Format ResultSink::parseFormat(const std::string &name)
+{
+    if (name == "vot")
+        return Format::VOT;
+    if (name == "csv")
+        return Format::CSV;
+    if (name == "binary")
+        return Format::BINARY;
+    throw std::runtime_error("Unknown output format: " + name);
+}
+
+void ResultSink::run()
+{
+    std::vector<TrackResult> batch;
+    Gaps gaps;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cond.wait(lock, [this] { return m_stop || !m_queue.empty() || !m_gaps.empty(); });
+            if (m_queue.empty() && m_gaps.empty())
+                break;
+            // Swap buffers, so that push() can continue while we write
+            batch.swap(m_queue);
+            gaps.swap(m_gaps);
+        }
+        write(batch, gaps);
+        batch.clear();
+        gaps.clear();
+    }
+    if (fflush(m_file) != 0)
+        fail("write");
+}
+
+void ResultSink::write(const std::vector<TrackResult> &batch, const Gaps &gaps)
+{
+    if (m_format == Format::BINARY) {
+        if (fwrite(batch.data(), sizeof(TrackResult), batch.size(), m_file) != batch.size())
+            fail("write");
+        return;
+    }
+
+    m_text.clear();
+    char line[256];
+    auto gap = gaps.begin();
+    for (size_t i = 0; i <= batch.size(); ++i) {
+        for (; gap != gaps.end() && gap->first == i; ++gap)
+            for (uint64_t n = 0; n < gap->second; ++n)
+                m_text.append("0,0,0,0\n");
+        if (i == batch.size())
+            break;
+        const TrackResult &r = batch[i];
+        int len;
+        if (m_format == Format::VOT)
+            len = snprintf(line, sizeof(line), "%d,%d,%d,%d\n", int(r.x), int(r.y), int(r.w), int(r.h));
+        else
+            len = snprintf(line, sizeof(line), "%d,%.2f,%.2f,%.2f,%.2f,%.2f,%.5f,%.3f,%.3f,%.3f,%.3f,%.3f,%.3f\n",
+                           r.frame, r.x, r.y, r.w, r.h, r.angle, r.response, r.psr, r.t_preprocess, r.t_detect,
+                           r.t_localize, r.t_train, r.latency);
+        m_text.append(line, std::min(size_t(len), sizeof(line) - 1));
+    }
+    if (fwrite(m_text.data(), 1, m_text.size(), m_file) != m_text.size())
+        fail("write");
+}
@@ -0,0 +1,87 @@
+#ifndef RESULT_SINK_HPP
+#define RESULT_SINK_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Tracking result of one frame
+struct TrackResult {
+    int32_t frame;
+    float x, y, w, h;  // axis-aligned bounding box
+    float angle;       // degrees
+    float response, psr;
+    // Stage durations in milliseconds (see KCF_FrameStats)
+    float t_preprocess, t_detect, t_localize, t_train, latency;
+};
+
+/*
+ * Writes tracking results to a file from a separate thread, so that slow
+ * storage does not delay tracking. push() only appends the result to a
+ * queue; the writer thread formats the queued results in batches and
+ * writes them with large buffered writes. If the writer falls behind by
+ * more than queue_limit results, new results are dropped and counted.
+ * As VOT output identifies frames by line numbers, a "0,0,0,0" line is
+ * written in place of each dropped result in that format.
+ *
+ * Write errors do not stop tracking. The first one is recorded and
+ * reported by error(), which should be checked after close().
+ *
+ * Formats:
+ * VOT    - "x,y,w,h" per line, as expected by the VOT toolkit
+ * CSV    - all fields of TrackResult with a header line
+ * BINARY - a header {uint32 magic "KCFB", uint32 version, uint32 record
+ *          size} followed by TrackResult records in native byte order
+ */
+class ResultSink {
+public:
+    enum class Format { VOT, CSV, BINARY };
+
+    static const uint32_t binary_magic = 0x4246434b; // "KCFB" in little endian
+    static const uint32_t binary_version = 1;
+
+    ResultSink(const std::string &file, Format format, size_t queue_limit = 1 << 20);
+    // Closes the file if close() was not called
+    ~ResultSink();
+
+    void push(const TrackResult &result);
+    // Writes all queued results and closes the file; push() must not be
+    // called afterwards
+    void close();
+    uint64_t dropped() const;
+    // Description of the first write error, empty if there was none
+    std::string error() const;
+
+    // Parses "vot", "csv" or "binary"
+    static Format parseFormat(const std::string &name);
+
+private:
+    // Queue positions before which placeholders of dropped results are
+    // written, with their counts (VOT format only)
+    typedef std::vector<std::pair<size_t, uint64_t>> Gaps;
+
+    void run();
+    void write(const std::vector<TrackResult> &batch, const Gaps &gaps);
+    void fail(const char *what);
+
+    FILE *m_file;
+    Format m_format;
+    size_t m_queue_limit;
+    std::vector<TrackResult> m_queue;
+    Gaps m_gaps;
+    uint64_t m_dropped = 0;
+    std::string m_error;
+    bool m_closed = false;
+    bool m_stop = false;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_cond;
+    std::string m_text; // formatting buffer of the writer thread
+    std::thread m_writer;
+};
+
+#endif // RESULT_SINK_HPP
@@ -0,0 +1,66 @@
+#ifndef SHM_RING_HPP
+#define SHM_RING_HPP
+
+#include <atomic>
+#include <cstdint>
+
+/*
+ * Layout of a frame ring in POSIX shared memory (see shmem.hpp), written
+ * by one producer (kcf_shm_producer) and read by one consumer (ShmIO).
+ * All frames have the format given in the header. The segment starts
+ * with ShmRing followed by 'slots' slots of 'slot_size' bytes, each
+ * starting with ShmRingSlot followed by the pixels.
+ *
+ * Synchronization is lock-free. Frame n (counted from 0) is stored in
+ * slot n % slots. The slot's sequence counter is a seqlock: the producer
+ * sets it to 2n+1 before writing the pixels and to 2n+2 afterwards, then
+ * publishes the frame by setting write_seq to n+1. The consumer sets
+ * read_seq to n+1 when it no longer uses frame n.
+ *
+ * The producer never writes a slot that may be in use by the consumer,
+ * i.e. it writes frame n only when n - read_seq < slots. When the ring
+ * is full, it either waits (back-pressure) or drops the new frame and
+ * counts it in 'dropped'. The consumer can skip to the newest frame, the
+ * skipped frames are counted in 'skipped'.
+ */
+struct ShmRingSlot {
+    std::atomic<uint64_t> seq;
+    uint64_t frame;    // frame number at the producer, including dropped frames
+    uint64_t align[6]; // pixels start at a cache line boundary
+};
+
+struct ShmRing {
+    static const uint32_t magic_value = 0x4b434652; // "KCFR"
+    static const uint32_t version_value = 1;
+
+    std::atomic<uint32_t> magic; // set last when the header is initialized
+    uint32_t version;
+    int32_t width, height;
+    int32_t type;      // OpenCV matrix type
+    uint32_t step;     // bytes per row
+    uint32_t slots;
+    uint64_t slot_size;
+    int32_t init_rect[4]; // x, y, width, height; zero width if unknown
+
+    std::atomic<uint64_t> write_seq;
+    std::atomic<uint64_t> read_seq;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> skipped;
+    std::atomic<uint32_t> consumer_attached;
+    std::atomic<uint32_t> closed; // no more frames will be written
+
+    static uint64_t header_size() { return (sizeof(ShmRing) + 63) / 64 * 64; }
+    static uint64_t slot_size_for(uint64_t frame_bytes) { return sizeof(ShmRingSlot) + (frame_bytes + 63) / 64 * 64; }
+    uint64_t total_size() const { return header_size() + slots * slot_size; }
+
+    ShmRingSlot &slot(uint64_t n)
+    {
+        return *reinterpret_cast<ShmRingSlot *>(reinterpret_cast<char *>(this) + header_size() + n % slots * slot_size);
+    }
+    void *pixels(uint64_t n) { return &slot(n) + 1; }
+};
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "Frame ring needs lock-free 64-bit atomics");
+static_assert(sizeof(ShmRingSlot) == 64, "Unexpected slot header size");
+
+#endif // SHM_RING_HPP
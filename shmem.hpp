@@ -0,0 +1,109 @@
+#ifndef SHMEM_HPP
+#define SHMEM_HPP
+
+#include <string>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * POSIX shared memory segment mapped into the address space of the
+ * process. Segments are identified by names of the form "/name". The
+ * process that created a segment unlinks the name on destruction, the
+ * mapping stays valid in other processes until they unmap it.
+ */
+class SharedMemory {
+public:
+    SharedMemory() {}
+    SharedMemory(SharedMemory &&other) { *this = std::move(other); }
+    SharedMemory &operator=(SharedMemory &&other)
+    {
+        if (this != &other) {
+            release();
+            std::swap(m_name, other.m_name);
+            std::swap(m_data, other.m_data);
+            std::swap(m_size, other.m_size);
+            std::swap(m_owner, other.m_owner);
+        }
+        return *this;
+    }
+    SharedMemory(const SharedMemory &) = delete;
+    SharedMemory &operator=(const SharedMemory &) = delete;
+    ~SharedMemory() { release(); }
+
+    // Creates a new segment, replacing a stale one of the same name
+    static SharedMemory create(const std::string &name, size_t size)
+    {
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd == -1)
+            fail("shm_open", name);
+        if (ftruncate(fd, off_t(size)) == -1) {
+            close(fd);
+            shm_unlink(name.c_str());
+            fail("ftruncate", name);
+        }
+        SharedMemory shm = map(fd, name, size, true);
+        shm.m_owner = true;
+        return shm;
+    }
+
+    // Maps an existing segment in its whole size
+    static SharedMemory open(const std::string &name, bool writable = false)
+    {
+        int fd = shm_open(name.c_str(), writable ? O_RDWR : O_RDONLY, 0);
+        if (fd == -1)
+            fail("shm_open", name);
+        struct stat st;
+        if (fstat(fd, &st) == -1) {
+            close(fd);
+            fail("fstat", name);
+        }
+        return map(fd, name, size_t(st.st_size), writable);
+    }
+
+    const std::string &name() const { return m_name; }
+    void *data() const { return m_data; }
+    size_t size() const { return m_size; }
+    bool valid() const { return m_data != nullptr; }
+
+private:
+    static SharedMemory map(int fd, const std::string &name, size_t size, bool writable)
+    {
+        void *data = mmap(nullptr, size, PROT_READ | (writable ? PROT_WRITE : 0), MAP_SHARED, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED)
+            fail("mmap", name);
+        SharedMemory shm;
+        shm.m_name = name;
+        shm.m_data = data;
+        shm.m_size = size;
+        return shm;
+    }
+
+    static void fail(const char *what, const std::string &name)
+    {
+        throw std::runtime_error(std::string(what) + "(" + name + "): " + strerror(errno));
+    }
+
+    void release()
+    {
+        if (m_data)
+            munmap(m_data, m_size);
+        if (m_owner)
+            shm_unlink(m_name.c_str());
+        m_data = nullptr;
+        m_size = 0;
+        m_owner = false;
+    }
+
+    std::string m_name;
+    void *m_data = nullptr;
+    size_t m_size = 0;
+    bool m_owner = false;
+};
+
+#endif // SHMEM_HPP
@@ -8,11 +8,7 @@ void Fft::init(unsigned width, unsigned height, unsigned num_of_feats, unsigned
     m_width = width;
     m_height = height;
     m_num_of_feats = num_of_feats;
-#ifdef BIG_BATCH
     m_num_of_scales = num_of_scales;
-#else
-    (void)num_of_scales;
-#endif
 }
 
 void Fft::set_window(const cv::UMat &window)
@@ -44,11 +40,7 @@ void Fft::forward(const cv::UMat &real_input, cv::UMat &complex_result)
 void Fft::forward_window(cv::UMat &patch_feats, cv::UMat &complex_result, cv::UMat &tmp)
 {
         assert(patch_feats.dims == 4);
-#ifdef BIG_BATCH
-        assert(patch_feats.size[0] == 1 || patch_feats.size[0] ==  int(m_num_of_scales));
-#else
         assert(patch_feats.size[0] == 1);
-#endif
         assert(patch_feats.size[1] == int(m_num_of_feats));
         assert(patch_feats.size[2] == int(m_height));
         assert(patch_feats.size[3] == int(m_width));
@@ -68,16 +60,12 @@ void Fft::forward_window(cv::UMat &patch_feats, cv::UMat &complex_result, cv::UM
         (void)tmp;
 }
 
-void Fft::inverse(cv::UMat &complex_input, cv::UMat &real_result)
+void Fft::inverse(cv::UMat &complex_input, cv::UMat &real_result, bool normalize)
 {
     TRACE("");
     DEBUG_PRINT(complex_input);
     assert(real_result.dims == 3);
-#ifdef BIG_BATCH
-        assert(real_result.size[0] == 1 || real_result.size[0] ==  int(m_num_of_scales));
-#else
-        assert(real_result.size[0] == 1);
-#endif
+    assert(real_result.size[0] == 1 || real_result.size[0] == int(m_num_of_scales));
     assert(real_result.size[1] == int(m_height));
     assert(real_result.size[2] == int(m_width));
 
@@ -87,4 +75,5 @@ void Fft::inverse(cv::UMat &complex_input, cv::UMat &real_result)
 
     (void)complex_input;
     (void)real_result;
+    (void)normalize;
 }
\ No newline at end of file
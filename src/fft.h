@@ -5,38 +5,38 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include <cassert>
-
-#ifdef BIG_BATCH
-#define BIG_BATCH_MODE 1
-#define IF_BIG_BATCH(true, false) true
-#else
-#define BIG_BATCH_MODE 0
-#define IF_BIG_BATCH(true, false) false
-#endif
+#include "kcf_config.h"
 
 class Fft
 {
 public:
-    void init(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales);
-    void set_window(const cv::UMat &window);
-    void forward(const cv::UMat &real_input, cv::UMat &complex_result);
-    void forward_window(cv::UMat &patch_feats, cv::UMat &complex_result, cv::UMat &tmp);
-    void inverse(cv::UMat &complex_input, cv::UMat &real_result);
+    virtual ~Fft() {}
+    // The implementations below only check the arguments. Backends
+    // override them and call them before doing the transform.
+    // Must be called before init()
+    virtual void set_options(const FftOptions &options) { m_options = options; }
+    virtual void init(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales);
+    virtual void set_window(const cv::UMat &window);
+    virtual void forward(const cv::UMat &real_input, cv::UMat &complex_result);
+    virtual void forward_window(cv::UMat &patch_feats, cv::UMat &complex_result, cv::UMat &tmp);
+    // The result is scaled by 1/(width*height) unless 'normalize' is
+    // false, in which case callers fold the scaling into their own
+    // computation.
+    virtual void inverse(cv::UMat &complex_input, cv::UMat &real_result, bool normalize = true);
 
+    // All backends store only the non-redundant half of the Hermitian
+    // spectrum of real input.
     static cv::Size freq_size(cv::Size space_size)
     {
         cv::Size ret(space_size);
-#if defined(CUFFT) || defined(FFTW)
         ret.width = space_size.width / 2 + 1;
-#endif
         return ret;
     }
 
 protected:
+    FftOptions m_options;
     unsigned m_width, m_height, m_num_of_feats;
-#ifdef BIG_BATCH
-    unsigned m_num_of_scales;
-#endif
+    unsigned m_num_of_scales; // number of responses transformed back by one inverse() call
 };
 
 #endif // FFT_H
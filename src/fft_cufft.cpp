@@ -40,17 +40,16 @@ void cuFFT::init(unsigned width, unsigned height, unsigned num_of_feats, unsigne
 {
     Fft::init(width, height, num_of_feats, num_of_scales);
 
-    std::cout << "FFT: cuFFT" << std::endl;
+    if (!m_options.probe)
+        std::cout << "FFT: cuFFT" << std::endl;
 
     plan_f = create_plan_fwd(1);
     plan_fw = create_plan_fwd(m_num_of_feats);
     plan_i_1ch = create_plan_inv(1);
 
-#ifdef BIG_BATCH
     plan_f_all_scales = create_plan_fwd(m_num_of_scales);
     plan_fw_all_scales = create_plan_fwd(m_num_of_scales * m_num_of_feats);
     plan_i_all_scales = create_plan_inv(m_num_of_scales);
-#endif
 }
 
 void cuFFT::set_window(const cv::Mat &window)
@@ -131,9 +130,7 @@ cuFFT::~cuFFT()
     cudaErrorCheck(cufftDestroy(plan_fw));
     cudaErrorCheck(cufftDestroy(plan_i_1ch));
 
-#ifdef BIG_BATCH
     cudaErrorCheck(cufftDestroy(plan_f_all_scales));
     cudaErrorCheck(cufftDestroy(plan_fw_all_scales));
     cudaErrorCheck(cufftDestroy(plan_i_all_scales));
-#endif
 }
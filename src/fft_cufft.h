@@ -29,9 +29,7 @@ protected:
 private:
     cv::Mat m_window;
     cufftHandle plan_f, plan_fw, plan_i_1ch;
-#ifdef BIG_BATCH
     cufftHandle plan_f_all_scales, plan_fw_all_scales, plan_i_all_scales;
-#endif
     cublasHandle_t cublas;
 };
 
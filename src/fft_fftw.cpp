@@ -1,6 +1,12 @@
 #include "fft_fftw.h"
 #include "matutil.h"
+#include "metrics.h"
 #include <unistd.h>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <set>
+#include <tuple>
 
 #ifdef OPENMP
 #include <omp.h>
@@ -66,6 +72,84 @@ GAPI_OCV_KERNEL(GCPUFftw, GFftw)
 
 Fftw::Fftw(){}
 
+static unsigned planner_flags(FftOptions::Rigor rigor)
+{
+    switch (rigor) {
+    case FftOptions::Rigor::ESTIMATE:   return FFTW_ESTIMATE;
+    case FftOptions::Rigor::MEASURE:    return FFTW_MEASURE;
+    case FftOptions::Rigor::PATIENT:    return FFTW_PATIENT;
+    case FftOptions::Rigor::EXHAUSTIVE: return FFTW_EXHAUSTIVE;
+    }
+    return FFTW_PATIENT;
+}
+
+// Plans are shared by all trackers in the process and live until its
+// end, so that re-initialization of a tracker does not plan again. The
+// FFTW planner is not thread safe, hence the mutex.
+static std::mutex plan_mutex;
+static std::map<std::tuple<uint, uint, uint, bool, FftOptions::Rigor, unsigned>, fftwf_plan> plan_cache;
+static std::set<std::string> imported_wisdom;
+static bool threads_initialized = false;
+
+fftwf_plan Fftw::cached_plan(uint howmany, bool inverse) const
+{
+    std::lock_guard<std::mutex> lock(plan_mutex);
+
+    auto key = std::make_tuple(m_width, m_height, howmany, inverse, m_options.rigor, m_options.threads);
+    static Counter &hits = MetricsRegistry::global().counter("kcf_fft_plan_cache_hits_total",
+                                                             "FFTW plans found in the plan cache");
+    static Counter &misses = MetricsRegistry::global().counter("kcf_fft_plan_cache_misses_total",
+                                                               "FFTW plans created");
+    auto it = m_options.probe ? plan_cache.end() : plan_cache.find(key);
+    if (it != plan_cache.end()) {
+        hits.inc();
+        return it->second;
+    }
+    if (!m_options.probe)
+        misses.inc();
+
+#ifndef CUFFTW
+    const std::string &wisdom = m_options.wisdom_file;
+    if (!wisdom.empty() && imported_wisdom.insert(wisdom).second) {
+        if (fftwf_import_wisdom_from_filename(wisdom.c_str()))
+            std::cout << "FFT: imported wisdom from " << wisdom << std::endl;
+    }
+#endif
+
+#ifndef CUFFTW
+    if (!threads_initialized)
+        threads_initialized = fftwf_init_threads();
+    if (threads_initialized)
+        fftwf_plan_with_nthreads(int(m_options.threads));
+#endif
+
+    fftwf_plan plan = inverse ? create_plan_inv(howmany) : create_plan_fwd(howmany);
+    if (m_options.probe) {
+        // Throw-away plan, destroyed with this object
+        m_probe_plans.push_back(plan);
+        return plan;
+    }
+    plan_cache[key] = plan;
+    m_planned = true;
+    return plan;
+}
+
+// The wisdom is written to a temporary file first, so that concurrent
+// processes never see (or produce) a partially written file.
+void Fftw::export_wisdom() const
+{
+#ifndef CUFFTW
+    const std::string &wisdom = m_options.wisdom_file;
+    std::string tmp = wisdom + ".tmp." + std::to_string(getpid());
+
+    std::lock_guard<std::mutex> lock(plan_mutex);
+    if (!fftwf_export_wisdom_to_filename(tmp.c_str()) || rename(tmp.c_str(), wisdom.c_str()) != 0) {
+        std::cerr << "FFT: cannot export wisdom to " << wisdom << std::endl;
+        unlink(tmp.c_str());
+    }
+#endif
+}
+
 fftwf_plan Fftw::create_plan_fwd(uint howmany) const
 {
     cv::Mat mat_in = cv::Mat::zeros(howmany * m_height, m_width, CV_32F);
@@ -79,7 +163,8 @@ fftwf_plan Fftw::create_plan_fwd(uint howmany) const
     int istride = 1, ostride = 1;
     int *inembed = NULL, *onembed = NULL;
 
-    return fftwf_plan_many_dft_r2c(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride, odist, FFTW_PATIENT);
+    return fftwf_plan_many_dft_r2c(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride, odist,
+                                   planner_flags(m_options.rigor));
 }
 
 fftwf_plan Fftw::create_plan_inv(uint howmany) const
@@ -95,39 +180,30 @@ fftwf_plan Fftw::create_plan_inv(uint howmany) const
     int istride = 1, ostride = 1;
     int *inembed = nullptr, *onembed = nullptr;
 
-    return fftwf_plan_many_dft_c2r(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride, odist, FFTW_PATIENT);
+    return fftwf_plan_many_dft_c2r(rank, n, howmany, in, inembed, istride, idist, out, onembed, ostride, odist,
+                                   planner_flags(m_options.rigor));
 }
 
 void Fftw::init(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales)
 {
     Fft::init(width, height, num_of_feats, num_of_scales);
 
-#if !defined(CUFFTW) && defined(BIG_BATCH)
-    fftw_init_threads();
-  #if defined(OPENMP)
-    fftw_plan_with_nthreads(omp_get_max_threads());
-  #else
-    int np = sysconf(_SC_NPROCESSORS_ONLN);
-    fftw_plan_with_nthreads(np);
-  #endif
-#endif
-
+    if (!m_options.probe) {
 #ifndef CUFFTW
-    std::cout << "FFT: FFTW" << std::endl;
+        std::cout << "FFT: FFTW";
+        if (m_options.threads > 1)
+            std::cout << ", " << m_options.threads << " threads";
+        std::cout << std::endl;
 #else
-    std::cout << "FFT: cuFFTW" << std::endl;
+        std::cout << "FFT: cuFFTW" << std::endl;
 #endif
-    fftwf_cleanup();
-
-    plan_f = create_plan_fwd(1);
-    plan_fw = create_plan_fwd(m_num_of_feats);
-    plan_i_1ch = create_plan_inv(1);
+    }
 
-#ifdef BIG_BATCH
-    plan_f_all_scales = create_plan_fwd(m_num_of_scales);
-    plan_fw_all_scales = create_plan_fwd(m_num_of_scales * m_num_of_feats);
-    plan_i_all_scales = create_plan_inv(m_num_of_scales);
-#endif
+    m_planned = false;
+    plan_f = cached_plan(1, false);
+    plan_i_1ch = cached_plan(1, true);
+    if (m_planned && !m_options.wisdom_file.empty())
+        export_wisdom();
 }
 
 void Fftw::set_window(const cv::UMat &window)
@@ -140,14 +216,8 @@ void Fftw::forward_cpu(const cv::UMat &real_input, cv::UMat &complex_result)
 {
     Fft::forward(real_input, complex_result);
 
-    if (real_input.dims == 2)
-        fftwf_execute_dft_r2c(plan_f, reinterpret_cast<float *>(real_input.getMat(cv::ACCESS_RW).data),
-                              reinterpret_cast<fftwf_complex *>(complex_result.getMat(cv::ACCESS_RW).ptr<std::complex<float>>(0)));
-#ifdef BIG_BATCH
-    else
-        fftwf_execute_dft_r2c(plan_f_all_scales, reinterpret_cast<float *>(real_input.getMat(cv::ACCESS_RW).data),
-                              reinterpret_cast<fftwf_complex *>(complex_result.getMat(cv::ACCESS_RW).ptr<std::complex<float>>(0)));
-#endif
+    fftwf_execute_dft_r2c(plan_f, reinterpret_cast<float *>(real_input.getMat(cv::ACCESS_RW).data),
+                          reinterpret_cast<fftwf_complex *>(complex_result.getMat(cv::ACCESS_RW).ptr<std::complex<float>>(0)));
 }
 
 void Fftw::forward(const cv::UMat &real_input, cv::UMat &complex_result)
@@ -158,13 +228,7 @@ void Fftw::forward(const cv::UMat &real_input, cv::UMat &complex_result)
     cv::Mat outputMat = complex_result.getMat(cv::ACCESS_RW);
     
     cv::GMat in;
-    cv::GMat out;
-    if (real_input.dims == 2)
-        out = GFftw::on(in, plan_f, 1, cv::Size(outputMat.cols,outputMat.rows));
-    #ifdef BIG_BATCH
-    else
-        out = GFftw::on(in, plan_f_all_scales, 1, cv::Size(outputMat.cols,outputMat.rows));        
-    #endif
+    cv::GMat out = GFftw::on(in, plan_f, 1, cv::Size(outputMat.cols,outputMat.rows));
     cv::GComputation fourierFwd(in, out);
     cv::gapi::GKernelPackage kernelPkg = cv::gapi::GKernelPackage();
     kernelPkg.include<GCPUFftw>();
@@ -183,14 +247,8 @@ void Fftw::forward_window_cpu(cv::UMat &feat, cv::UMat & complex_result, cv::UMa
             temp_plane = feat_plane.mul(m_window);
             
             tempRes = cv::UMat::zeros(complex_result.rows, complex_result.cols, CV_32FC2);
-            if (feat.size[0] == 1)
-                fftwf_execute_dft_r2c(plan_f, reinterpret_cast<float *>(temp_plane.getMat(cv::ACCESS_RW).data),
-                              reinterpret_cast<fftwf_complex *>(tempRes.getMat(cv::ACCESS_RW).ptr<std::complex<float>>(0)));
-            #ifdef BIG_BATCH
-            else
-                fftwf_execute_dft_r2c(plan_fw_all_scales, reinterpret_cast<float *>(temp_plane.getMat(cv::ACCESS_RW).data),
-                              reinterpret_cast<fftwf_complex *>(tempRes.getMat(cv::ACCESS_RW).ptr<std::complex<float>>(0)));
-            #endif
+            fftwf_execute_dft_r2c(plan_f, reinterpret_cast<float *>(temp_plane.getMat(cv::ACCESS_RW).data),
+                                  reinterpret_cast<fftwf_complex *>(tempRes.getMat(cv::ACCESS_RW).ptr<std::complex<float>>(0)));
             MatUtil::set_channel(0, int(j * 2), tempRes, complex_result);
             MatUtil::set_channel(1, int(j * 2 + 1), tempRes, complex_result);
         }
@@ -202,13 +260,7 @@ void Fftw::forward_window(cv::UMat &feat, cv::UMat & complex_result, cv::UMat &t
     Fft::forward_window(feat, complex_result, temp);
 
     cv::GMat in;
-    cv::GMat out;
-    if (feat.size[0] == 1)
-        out = GFftw::on(in, plan_f, 1, cv::Size(complex_result.cols, complex_result.rows));
-    #ifdef BIG_BATCH
-    else
-        out = GFftw::on(in, plan_f_all_scales, 1, cv::Size(complex_result.cols,complex_result.rows));        
-    #endif
+    cv::GMat out = GFftw::on(in, plan_f, 1, cv::Size(complex_result.cols, complex_result.rows));
     cv::GComputation fourierFwd(in, out);
     cv::gapi::GKernelPackage kernelPkg = cv::gapi::GKernelPackage();
     kernelPkg.include<GCPUFftw>();    
@@ -231,54 +283,52 @@ void Fftw::forward_window(cv::UMat &feat, cv::UMat & complex_result, cv::UMat &t
     }
 }
 
-void Fftw::inverse_cpu(cv::UMat &complex_input, cv::UMat &real_result)
+// Batched input holds one complex channel per plane of the result. The
+// planes are transformed one by one, as FFTW's batched plans expect
+// non-interleaved input.
+void Fftw::inverse_cpu(cv::UMat &complex_input, cv::UMat &real_result, bool normalize)
 {
-    Fft::inverse(complex_input, real_result);
-
-    fftwf_complex *in = reinterpret_cast<fftwf_complex *>(complex_input.getMat(cv::ACCESS_RW).ptr<std::complex<float>>(0));
-    float *out = real_result.getMat(cv::ACCESS_RW).ptr<float>();
-
-    if (complex_input.channels() == 2)
-        fftwf_execute_dft_c2r(plan_i_1ch, in, out);
-#ifdef BIG_BATCH
-    else
-        fftwf_execute_dft_c2r(plan_i_all_scales, in, out);
-#endif
-    real_result.getMat(cv::ACCESS_RW) *= 1.0 / (m_width * m_height);
+    Fft::inverse(complex_input, real_result, normalize);
+
+    cv::UMat inputChannel;
+    for (uint i = 0; i < uint(complex_input.channels() / 2); ++i) {
+        inputChannel = complex_input.channels() == 2 ? complex_input : MatUtil::channel_to_cv_mat(i * 2, complex_input);
+        cv::UMat target = MatUtil::plane(i, real_result);
+        cv::Mat outputMat = target.getMat(cv::ACCESS_RW);
+        fftwf_execute_dft_c2r(plan_i_1ch,
+                              reinterpret_cast<fftwf_complex *>(inputChannel.getMat(cv::ACCESS_RW).ptr<std::complex<float>>(0)),
+                              outputMat.ptr<float>());
+        if (normalize)
+            outputMat *= 1.0 / (m_width * m_height);
+    }
 }
 
-void Fftw::inverse(cv::UMat &complex_input, cv::UMat &real_result)
+void Fftw::inverse(cv::UMat &complex_input, cv::UMat &real_result, bool normalize)
 {
-    Fft::inverse(complex_input, real_result);
+    Fft::inverse(complex_input, real_result, normalize);
 
-    cv::Mat inputMat = complex_input.getMat(cv::ACCESS_RW);
-    cv::UMat tempOutMat = MatUtil::plane(0,real_result);
-    cv::Mat outputMat = tempOutMat.getMat(cv::ACCESS_RW);
-    
     cv::GMat in;
-    cv::GMat out;
-    if (complex_input.channels() == 2)
-        out = GFftw::on(in, plan_i_1ch, 2, cv::Size(outputMat.cols,outputMat.rows));
-    #ifdef BIG_BATCH
-    else
-        out = GFftw::on(in, plan_i_all_scales, 2, cv::Size(outputMat.cols,outputMat.rows));        
-    #endif
+    cv::GMat out = GFftw::on(in, plan_i_1ch, 2, cv::Size(m_width, m_height));
     cv::GComputation fourierInv(in, out);
     cv::gapi::GKernelPackage kernelPkg = cv::gapi::GKernelPackage();
     kernelPkg.include<GCPUFftw>();
-    fourierInv.apply(inputMat, outputMat, cv::compile_args(kernelPkg));
-    outputMat *= 1.0 / (m_width * m_height);
+
+    cv::UMat inputChannel;
+    for (uint i = 0; i < uint(complex_input.channels() / 2); ++i) {
+        inputChannel = complex_input.channels() == 2 ? complex_input : MatUtil::channel_to_cv_mat(i * 2, complex_input);
+        cv::UMat target = MatUtil::plane(i, real_result);
+        cv::Mat inputMat = inputChannel.getMat(cv::ACCESS_RW);
+        cv::Mat outputMat = target.getMat(cv::ACCESS_RW);
+        fourierInv.apply(inputMat, outputMat, cv::compile_args(kernelPkg));
+        if (normalize)
+            outputMat *= 1.0 / (m_width * m_height);
+    }
 }
 
+// Plans other than probe plans are owned by the plan cache
 Fftw::~Fftw()
 {
-    if (plan_f) fftwf_destroy_plan(plan_f);
-    if (plan_fw) fftwf_destroy_plan(plan_fw);
-    if (plan_i_1ch) fftwf_destroy_plan(plan_i_1ch);
-
-#ifdef BIG_BATCH
-    if (plan_f_all_scales) fftwf_destroy_plan(plan_f_all_scales);
-    if (plan_fw_all_scales) fftwf_destroy_plan(plan_fw_all_scales);
-    if (plan_i_all_scales) fftwf_destroy_plan(plan_i_all_scales);
-#endif
+    std::lock_guard<std::mutex> lock(plan_mutex);
+    for (fftwf_plan plan : m_probe_plans)
+        fftwf_destroy_plan(plan);
 }
@@ -17,24 +17,26 @@ class Fftw : public Fft
     void set_window(const cv::UMat &window);
     void forward(const cv::UMat &real_input, cv::UMat &complex_result);
     void forward_window(cv::UMat &feat, cv::UMat & complex_result, cv::UMat &temp);
-    void inverse(cv::UMat &complex_input, cv::UMat &real_result);
+    void inverse(cv::UMat &complex_input, cv::UMat &real_result, bool normalize = true);
     
     void forward_cpu(const cv::UMat &real_input, cv::UMat &complex_result);
     void forward_window_cpu(cv::UMat &feat, cv::UMat & complex_result, cv::UMat &temp);
-    void inverse_cpu(cv::UMat &complex_input, cv::UMat &real_result);
+    void inverse_cpu(cv::UMat &complex_input, cv::UMat &real_result, bool normalize = true);
     
     ~Fftw();
 
 protected:
     fftwf_plan create_plan_fwd(uint howmany) const;
     fftwf_plan create_plan_inv(uint howmany) const;
+    // Returns plan from the process-wide cache, creating it if needed
+    fftwf_plan cached_plan(uint howmany, bool inverse) const;
+    void export_wisdom() const;
 
 private:
     cv::UMat m_window;
-    fftwf_plan plan_f = 0, plan_fw = 0, plan_i_1ch = 0;
-#ifdef BIG_BATCH
-    fftwf_plan plan_f_all_scales = 0, plan_fw_all_scales = 0, plan_i_all_scales = 0;
-#endif
+    fftwf_plan plan_f = 0, plan_i_1ch = 0;
+    mutable bool m_planned = false; // cached_plan() created a plan since the last init()
+    mutable std::vector<fftwf_plan> m_probe_plans; // not cached, see FftOptions::probe
 };
 
 #endif // FFT_FFTW_H
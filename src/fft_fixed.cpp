@@ -0,0 +1,233 @@
+#include "fft_fixed.h"
+#include "debug.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+template <int N>
+struct FixedTables {
+    float cos[N / 2], sin[N / 2]; // exp(-2*pi*i*k/N) = cos[k] - i*sin[k]
+    int bitrev[N];
+
+    FixedTables()
+    {
+        for (int k = 0; k < N / 2; ++k) {
+            cos[k] = float(std::cos(2 * M_PI * k / N));
+            sin[k] = float(std::sin(2 * M_PI * k / N));
+        }
+        for (int i = 0; i < N; ++i) {
+            int r = 0;
+            for (int bit = 1, rbit = N / 2; bit < N; bit <<= 1, rbit >>= 1)
+                if (i & bit)
+                    r |= rbit;
+            bitrev[i] = r;
+        }
+    }
+};
+
+// Iterative radix-2 decimation in time. With N known at compile time the
+// loops over k are fully unrolled; the innermost loop over interleaved
+// sequences is contiguous in memory and gets vectorized.
+template <int N, bool INVERSE>
+static void fixed_fft(float *data, int stride, int count)
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "N must be a power of two");
+    static const FixedTables<N> t;
+
+    for (int i = 0; i < N; ++i) {
+        int j = t.bitrev[i];
+        if (i < j)
+            std::swap_ranges(data + 2 * i * stride, data + 2 * (i * stride + count), data + 2 * j * stride);
+    }
+
+    for (int half = 1; half < N; half *= 2) {
+        const int step = N / (2 * half);
+        for (int i = 0; i < N; i += 2 * half) {
+            for (int k = 0; k < half; ++k) {
+                const float wr = t.cos[k * step];
+                const float wi = INVERSE ? t.sin[k * step] : -t.sin[k * step];
+                float *a = data + 2 * (i + k) * stride;
+                float *b = data + 2 * (i + k + half) * stride;
+                for (int j = 0; j < 2 * count; j += 2) {
+                    float tr = b[j] * wr - b[j + 1] * wi;
+                    float ti = b[j] * wi + b[j + 1] * wr;
+                    b[j] = a[j] - tr;
+                    b[j + 1] = a[j + 1] - ti;
+                    a[j] += tr;
+                    a[j + 1] += ti;
+                }
+            }
+        }
+    }
+}
+
+template <bool INVERSE>
+static FftFixed::kernel_fn fixed_kernel(int n)
+{
+    switch (n) {
+    case 8:   return &fixed_fft<8, INVERSE>;
+    case 16:  return &fixed_fft<16, INVERSE>;
+    case 32:  return &fixed_fft<32, INVERSE>;
+    case 64:  return &fixed_fft<64, INVERSE>;
+    case 128: return &fixed_fft<128, INVERSE>;
+    }
+    return nullptr;
+}
+
+bool FftFixed::supported(cv::Size size)
+{
+    return fixed_kernel<false>(size.width) && fixed_kernel<false>(size.height);
+}
+
+void FftFixed::init(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales)
+{
+    Fft::init(width, height, num_of_feats, num_of_scales);
+    assert(supported(cv::Size(width, height)));
+    if (!m_options.probe)
+        std::cout << "FFT: fixed-size" << std::endl;
+
+    m_row_fwd = fixed_kernel<false>(width);
+    m_row_inv = fixed_kernel<true>(width);
+    m_col_fwd = fixed_kernel<false>(height);
+    m_col_inv = fixed_kernel<true>(height);
+}
+
+void FftFixed::set_window(const cv::UMat &window)
+{
+    Fft::set_window(window);
+    window.copyTo(m_window);
+}
+
+// Scratch buffers - the transforms are called from multiple threads
+static float *scratch(std::vector<float> &buf, size_t size)
+{
+    if (buf.size() < size)
+        buf.resize(size);
+    return buf.data();
+}
+
+// Transforms 'nch' real H x W planes (optionally multiplied by window)
+// to H x (W/2+1) half spectra stored with interleaved channels, i.e.
+// the layout of the multi-channel complex matrices used by the tracker.
+// Rows y and y+1 are transformed together as the real and imaginary
+// part of one complex sequence z = a + ib and separated by
+// A[k] = (Z[k] + conj(Z[-k])) / 2, B[k] = (Z[k] - conj(Z[-k])) / 2i.
+// All channels go through each kernel call at once, so the innermost
+// loops run over the channels.
+void FftFixed::r2c(const float *in, size_t plane_step, size_t in_step, int nch, const float *window,
+                   float *half) const
+{
+    thread_local std::vector<float> row_buf;
+    const int w = m_width, h = m_height, hw = w / 2 + 1;
+    float *z = scratch(row_buf, 2 * w * nch);
+
+    for (int y = 0; y < h; y += 2) {
+        for (int ch = 0; ch < nch; ++ch) {
+            const float *a = in + ch * plane_step + y * in_step, *b = a + in_step;
+            float *zc = z + 2 * ch;
+            if (window) {
+                const float *wa = window + y * w, *wb = wa + w;
+                for (int n = 0; n < w; ++n) {
+                    zc[2 * n * nch] = a[n] * wa[n];
+                    zc[2 * n * nch + 1] = b[n] * wb[n];
+                }
+            } else {
+                for (int n = 0; n < w; ++n) {
+                    zc[2 * n * nch] = a[n];
+                    zc[2 * n * nch + 1] = b[n];
+                }
+            }
+        }
+        m_row_fwd(z, nch, nch);
+
+        float *ha = half + 2 * y * hw * nch, *hb = ha + 2 * hw * nch;
+        for (int k = 0; k < hw; ++k) {
+            const float *zk = z + 2 * k * nch, *zc = z + 2 * ((w - k) % w) * nch;
+            float *hak = ha + 2 * k * nch, *hbk = hb + 2 * k * nch;
+            for (int j = 0; j < 2 * nch; j += 2) {
+                const float zr = zk[j], zi = zk[j + 1], cr = zc[j], ci = -zc[j + 1];
+                hak[j] = 0.5f * (zr + cr);
+                hak[j + 1] = 0.5f * (zi + ci);
+                hbk[j] = 0.5f * (zi - ci);
+                hbk[j + 1] = -0.5f * (zr - cr);
+            }
+        }
+    }
+    m_col_fwd(half, hw * nch, hw * nch);
+}
+
+// Inverse of r2c(), the result is multiplied by scale and stored to
+// 'nch' planes of H x W. Destroys the input.
+void FftFixed::c2r(float *half, int nch, float *out, float scale) const
+{
+    thread_local std::vector<float> row_buf;
+    const int w = m_width, h = m_height, hw = w / 2 + 1;
+    float *z = scratch(row_buf, 2 * w * nch);
+
+    m_col_inv(half, hw * nch, hw * nch);
+
+    for (int y = 0; y < h; y += 2) {
+        const float *ha = half + 2 * y * hw * nch, *hb = ha + 2 * hw * nch;
+        // z = A + iB with the upper half of A and B from Hermitian symmetry
+        for (int k = 0; k < w; ++k) {
+            const int c = k < hw ? k : w - k;
+            const float sign = k < hw ? 1.f : -1.f;
+            const float *hac = ha + 2 * c * nch, *hbc = hb + 2 * c * nch;
+            float *zk = z + 2 * k * nch;
+            for (int j = 0; j < 2 * nch; j += 2) {
+                zk[j] = hac[j] - sign * hbc[j + 1];
+                zk[j + 1] = sign * hac[j + 1] + hbc[j];
+            }
+        }
+        m_row_inv(z, nch, nch);
+
+        for (int ch = 0; ch < nch; ++ch) {
+            float *a = out + ch * h * w + y * w, *b = a + w;
+            const float *zc = z + 2 * ch;
+            for (int n = 0; n < w; ++n) {
+                a[n] = zc[2 * n * nch] * scale;
+                b[n] = zc[2 * n * nch + 1] * scale;
+            }
+        }
+    }
+}
+
+void FftFixed::forward(const cv::UMat &real_input, cv::UMat &complex_result)
+{
+    Fft::forward(real_input, complex_result);
+
+    cv::Mat in = real_input.getMat(cv::ACCESS_READ);
+    cv::Mat out = complex_result.getMat(cv::ACCESS_WRITE);
+    assert(out.isContinuous());
+
+    r2c(in.ptr<float>(), 0, in.step1(), 1, nullptr, out.ptr<float>());
+}
+
+void FftFixed::forward_window(cv::UMat &feat, cv::UMat &complex_result, cv::UMat &temp)
+{
+    Fft::forward_window(feat, complex_result, temp);
+    (void)temp;
+
+    cv::Mat in = feat.getMat(cv::ACCESS_READ);
+    cv::Mat out = complex_result.getMat(cv::ACCESS_WRITE);
+    assert(in.isContinuous() && out.isContinuous());
+
+    r2c(in.ptr<float>(), m_height * m_width, m_width, in.size[0] * in.size[1], m_window.ptr<float>(),
+        out.ptr<float>());
+}
+
+void FftFixed::inverse(cv::UMat &complex_input, cv::UMat &real_result, bool normalize)
+{
+    Fft::inverse(complex_input, real_result, normalize);
+
+    cv::Mat in = complex_input.getMat(cv::ACCESS_READ);
+    cv::Mat out = real_result.getMat(cv::ACCESS_WRITE);
+    assert(in.isContinuous() && out.isContinuous());
+    thread_local std::vector<float> half_buf;
+    const size_t n = in.total() * in.channels();
+    float *half = scratch(half_buf, n);
+    const float scale = normalize ? 1.f / (m_width * m_height) : 1.f;
+
+    std::copy(in.ptr<float>(), in.ptr<float>() + n, half);
+    c2r(half, in.channels() / 2, out.ptr<float>(), scale);
+}
@@ -0,0 +1,37 @@
+#ifndef FFT_FIXED_H
+#define FFT_FIXED_H
+
+#include "fft.h"
+
+/*
+ * FFT backend for small power-of-two sizes (8 to 128 in each dimension),
+ * as produced by --fit. The transform kernels are specialized for each
+ * size at compile time. The row passes process all feature channels and
+ * the column passes all columns and channels of a row at once, which
+ * lets the compiler vectorize them. Real input is transformed two rows
+ * at a time by a single complex FFT.
+ */
+class FftFixed : public Fft
+{
+public:
+    static bool supported(cv::Size size);
+
+    void init(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales) override;
+    void set_window(const cv::UMat &window) override;
+    void forward(const cv::UMat &real_input, cv::UMat &complex_result) override;
+    void forward_window(cv::UMat &feat, cv::UMat &complex_result, cv::UMat &temp) override;
+    void inverse(cv::UMat &complex_input, cv::UMat &real_result, bool normalize = true) override;
+
+    // Transforms 'count' interleaved complex sequences in place. Element n
+    // of sequence j is at data[2 * (n * stride + j)].
+    typedef void (*kernel_fn)(float *data, int stride, int count);
+
+private:
+    void r2c(const float *in, size_t plane_step, size_t in_step, int nch, const float *window, float *half) const;
+    void c2r(float *half, int nch, float *out, float scale) const;
+
+    kernel_fn m_row_fwd, m_row_inv, m_col_fwd, m_col_inv;
+    cv::Mat m_window;
+};
+
+#endif // FFT_FIXED_H
@@ -72,10 +72,36 @@ GAPI_OCV_KERNEL(GCPUDft, GDft)
     }
 };
 
+// cv::dft() produces the full complex spectrum of real input. Only the
+// non-redundant half (width/2+1 columns) is kept, which is the layout
+// shared by all FFT backends (see Fft::freq_size()).
+static cv::Mat hermitian_half(const cv::Mat &full)
+{
+    return full.colRange(0, full.cols / 2 + 1);
+}
+
+// Reconstructs the full spectrum of width 'width' from its half using
+// Hermitian symmetry F(y, x) = conj(F(-y, -x)).
+static cv::Mat hermitian_full(const cv::Mat &half, int width)
+{
+    assert(half.type() == CV_32FC2);
+    assert(half.cols == width / 2 + 1);
+    cv::Mat full(half.rows, width, CV_32FC2);
+    half.copyTo(full.colRange(0, half.cols));
+    for (int y = 0; y < half.rows; ++y) {
+        const std::complex<float> *src = half.ptr<std::complex<float>>((half.rows - y) % half.rows);
+        std::complex<float> *dst = full.ptr<std::complex<float>>(y);
+        for (int x = half.cols; x < width; ++x)
+            dst[x] = std::conj(src[width - x]);
+    }
+    return full;
+}
+
 void FftOpencv::init(unsigned width, unsigned height, unsigned num_of_feats, unsigned num_of_scales)
 {
     Fft::init(width, height, num_of_feats, num_of_scales);
-    std::cout << "FFT: OpenCV" << std::endl;
+    if (!m_options.probe)
+        std::cout << "FFT: OpenCV" << std::endl;
 }
 
 void FftOpencv::set_window(const cv::UMat &window)
@@ -86,8 +112,10 @@ void FftOpencv::set_window(const cv::UMat &window)
 void FftOpencv::forward_cpu(const cv::UMat &real_input, cv::UMat &complex_result)
 {
     Fft::forward(real_input, complex_result);
- 
-    cv::dft(real_input, complex_result, cv::DFT_COMPLEX_OUTPUT);
+
+    cv::Mat full;
+    cv::dft(real_input, full, cv::DFT_COMPLEX_OUTPUT);
+    hermitian_half(full).copyTo(complex_result);
 }
 
 void FftOpencv::forward(const cv::UMat &real_input, cv::UMat &complex_result)
@@ -95,7 +123,7 @@ void FftOpencv::forward(const cv::UMat &real_input, cv::UMat &complex_result)
     Fft::forward(real_input, complex_result);
     
     cv::Mat inputMat = real_input.getMat(cv::ACCESS_RW);
-    cv::Mat outputMat = complex_result.getMat(cv::ACCESS_RW);
+    cv::Mat outputMat;
     
     cv::GMat in;
     cv::GMat out;
@@ -104,6 +132,7 @@ void FftOpencv::forward(const cv::UMat &real_input, cv::UMat &complex_result)
     cv::gapi::GKernelPackage kernelPkg = cv::gapi::GKernelPackage();
     kernelPkg.include<GCPUDft>();
     fourierFwd.apply(inputMat, outputMat, cv::compile_args(kernelPkg));
+    hermitian_half(outputMat).copyTo(complex_result);
 }
 
 // Real and imag parts of complex elements from previous ComplexMat format are represented by 2 neighbouring channels.
@@ -113,11 +142,12 @@ void FftOpencv::forward_window_cpu(cv::UMat &feat, cv::UMat &complex_result, cv:
     (void) temp;
     for (uint i = 0; i < uint(feat.size[0]); ++i) {
         for (uint j = 0; j < uint(feat.size[1]); ++j) {
-            cv::UMat complex_res;
+            cv::Mat complex_res;
             cv::UMat channel = MatUtil::plane(i, j, feat);
             cv::dft(channel.mul(m_window), complex_res, cv::DFT_COMPLEX_OUTPUT);
-            MatUtil::set_channel(int(0), int(2*j), complex_res, complex_result);
-            MatUtil::set_channel(int(1), int(2*j+1), complex_res, complex_result);
+            cv::UMat half = hermitian_half(complex_res).getUMat(cv::ACCESS_RW);
+            MatUtil::set_channel(int(0), int(2*j), half, complex_result);
+            MatUtil::set_channel(int(1), int(2*j+1), half, complex_result);
         }
     }
 }
@@ -143,15 +173,16 @@ void FftOpencv::forward_window(cv::UMat &feat, cv::UMat &complex_result, cv::UMa
         for (uint j = 0; j < uint(feat.size[1]); ++j) {
             channel = MatUtil::plane(i, j, featTemp).mul(m_window);
             fourierFwdWin.apply(channel, complex_res, cv::compile_args(kernelPkg));
-            MatUtil::set_channel(int(0), int(2*j), complex_res, cpxResTemp);
-            MatUtil::set_channel(int(1), int(2*j+1), complex_res, cpxResTemp);
+            cv::Mat half = hermitian_half(complex_res);
+            MatUtil::set_channel(int(0), int(2*j), half, cpxResTemp);
+            MatUtil::set_channel(int(1), int(2*j+1), half, cpxResTemp);
         }
     }
 }
 
-void FftOpencv::inverse_cpu(cv::UMat &complex_input, cv::UMat &real_result)
+void FftOpencv::inverse_cpu(cv::UMat &complex_input, cv::UMat &real_result, bool normalize)
 {
-    Fft::inverse(complex_input, real_result);
+    Fft::inverse(complex_input, real_result, normalize);
 
     assert(complex_input.channels() % 2 == 0);
     cv::UMat inputChannel;
@@ -159,17 +190,18 @@ void FftOpencv::inverse_cpu(cv::UMat &complex_input, cv::UMat &real_result)
     for (uint i = 0; i < uint(complex_input.channels() / 2); ++i) {
         inputChannel = MatUtil::channel_to_cv_mat(i*2, complex_input);  // extract input channel matrix
         target = MatUtil::plane(i, real_result);                        // select output plane
-        cv::dft(inputChannel, target, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+        cv::dft(hermitian_full(inputChannel.getMat(cv::ACCESS_READ), int(m_width)), target,
+                cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | (normalize ? cv::DFT_SCALE : 0));
     }
 }
 
-void FftOpencv::inverse(cv::UMat &complex_input, cv::UMat &real_result)
+void FftOpencv::inverse(cv::UMat &complex_input, cv::UMat &real_result, bool normalize)
 {
-    Fft::inverse(complex_input, real_result);
+    Fft::inverse(complex_input, real_result, normalize);
     
     cv::GMat in;
     cv::GMat out;
-    out = GDft::on(in, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | cv::DFT_SCALE);
+    out = GDft::on(in, cv::DFT_INVERSE | cv::DFT_REAL_OUTPUT | (normalize ? cv::DFT_SCALE : 0));
     cv::GComputation fourierInv(in, out);
     cv::gapi::GKernelPackage kernelPkg = cv::gapi::GKernelPackage();
     kernelPkg.include<GCPUDft>();
@@ -182,7 +214,7 @@ void FftOpencv::inverse(cv::UMat &complex_input, cv::UMat &real_result)
     for (uint i = 0; i < uint(complex_input.channels() / 2); ++i) {
         inputChannel = MatUtil::channel_to_cv_mat(i*2, complex_input);  // extract input channel matrix
         target = MatUtil::plane(i, real_result);                        // select output plane
-        matInputChannel = inputChannel.getMat(cv::ACCESS_RW);
+        matInputChannel = hermitian_full(inputChannel.getMat(cv::ACCESS_RW), int(m_width));
         matTarget = target.getMat(cv::ACCESS_RW);
         fourierInv.apply(matInputChannel, matTarget, cv::compile_args(kernelPkg));
     }
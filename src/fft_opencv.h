@@ -11,11 +11,11 @@ public:
     void set_window(const cv::UMat &window);
     void forward(const cv::UMat &real_input, cv::UMat &complex_result);
     void forward_window(cv::UMat &feat, cv::UMat &complex_result, cv::UMat &temp);
-    void inverse(cv::UMat &complex_input, cv::UMat &real_result);
+    void inverse(cv::UMat &complex_input, cv::UMat &real_result, bool normalize = true);
     
     void forward_cpu(const cv::UMat &real_input, cv::UMat &complex_result);
     void forward_window_cpu(cv::UMat &feat, cv::UMat &complex_result, cv::UMat &temp);
-    void inverse_cpu(cv::UMat &complex_input, cv::UMat &real_result);
+    void inverse_cpu(cv::UMat &complex_input, cv::UMat &real_result, bool normalize = true);
     ~FftOpencv();
 private:
     cv::UMat m_window;
@@ -0,0 +1,90 @@
+#include "governor.h"
+#include <algorithm>
+#include <cmath>
+#include <utility>
+#include <vector>
+
+constexpr unsigned LatencyGovernor::max_train_interval;
+
+static void ewma(double &avg, double sample, bool &initialized, double weight)
+{
+    avg = initialized ? avg + weight * (sample - avg) : sample;
+    initialized = true;
+}
+
+void LatencyGovernor::reset(unsigned num_scales, unsigned num_angles, unsigned parallel_width)
+{
+    m_parallel_width = std::max(1u, parallel_width);
+    m_max_scale_radius = (num_scales - 1) / 2;
+    m_max_angle_radius = (num_angles - 1) / 2;
+
+    m_costs = Costs();
+    m_have_base = m_have_context = m_have_subgrid = m_have_train = false;
+
+    // Start with full effort - the costs are learned during the first frames
+    full_effort();
+}
+
+void LatencyGovernor::full_effort()
+{
+    m_decision = Decision();
+    m_decision.scale_radius = m_max_scale_radius;
+    m_decision.angle_radius = m_max_angle_radius;
+}
+
+const LatencyGovernor::Decision &LatencyGovernor::decide(double target_ms)
+{
+    if (!m_have_base || !m_have_context || !m_have_train)
+        return m_decision;
+
+    const double budget = target_ms * headroom;
+    const double subgrid = m_have_subgrid ? m_costs.subgrid : 0;
+    Decision d;
+
+    // Candidate search grids ordered by decreasing number of contexts, so
+    // that the largest grid is chosen among those taking the same rounds
+    std::vector<std::pair<unsigned, unsigned>> grids;
+    for (unsigned s = 0; s <= m_max_scale_radius; ++s)
+        for (unsigned a = 0; a <= m_max_angle_radius; ++a)
+            grids.emplace_back(s, a);
+    auto count = [](const std::pair<unsigned, unsigned> &g) { return (2 * g.first + 1) * (2 * g.second + 1); };
+    std::stable_sort(grids.begin(), grids.end(),
+                     [&](const std::pair<unsigned, unsigned> &a, const std::pair<unsigned, unsigned> &b) {
+                         return count(a) > count(b) || (count(a) == count(b) && a.first > b.first);
+                     });
+
+    for (const auto &g : grids) {
+        d.scale_radius = g.first;
+        d.angle_radius = g.second;
+        d.predicted = m_costs.base + rounds(count(g)) * m_costs.context + subgrid + m_costs.train;
+        if (d.predicted <= budget) {
+            m_decision = d;
+            return m_decision;
+        }
+    }
+
+    // Even a single context does not fit - drop interpolation and train less often
+    d.scale_radius = d.angle_radius = 0;
+    d.subgrid = false;
+    double slack = budget - m_costs.base - m_costs.context;
+    if (slack >= m_costs.train)
+        d.train_interval = 1;
+    else if (slack <= 0)
+        d.train_interval = max_train_interval;
+    else
+        d.train_interval = std::min(max_train_interval, unsigned(std::ceil(m_costs.train / slack)));
+    d.predicted = m_costs.base + m_costs.context + m_costs.train / d.train_interval;
+    m_decision = d;
+    return m_decision;
+}
+
+void LatencyGovernor::update(const Costs &measured, unsigned num_rounds, bool subgrid, bool trained)
+{
+    ewma(m_costs.base, measured.base, m_have_base, smoothing);
+    if (num_rounds > 0)
+        ewma(m_costs.context, measured.context / num_rounds, m_have_context, smoothing);
+    if (subgrid)
+        ewma(m_costs.subgrid, measured.subgrid, m_have_subgrid, smoothing);
+    if (trained)
+        ewma(m_costs.train, measured.train, m_have_train, smoothing);
+}
@@ -0,0 +1,61 @@
+#ifndef GOVERNOR_H
+#define GOVERNOR_H
+
+/*
+ * Latency governor adapts the per-frame search effort of the tracker so
+ * that processing of a frame fits into a given time budget. It keeps
+ * running estimates of the cost of individual tracking stages and before
+ * each frame decides how many scale/angle contexts to evaluate, whether
+ * to perform sub-grid interpolation and how often to train the model.
+ */
+class LatencyGovernor
+{
+public:
+    struct Decision {
+        unsigned scale_radius = 0;   // evaluate scales centre +/- scale_radius
+        unsigned angle_radius = 0;   // evaluate angles centre +/- angle_radius
+        bool subgrid = true;         // sub-grid scale/angle interpolation
+        unsigned train_interval = 1; // train every train_interval-th frame
+        double predicted = 0;        // predicted frame latency [ms]
+    };
+
+    // Cost of tracking stages in milliseconds
+    struct Costs {
+        double base = 0;    // pre-processing and localization, independent of the decision
+        double context = 0; // evaluation of one round of up to parallel_width scale/angle contexts
+        double subgrid = 0; // sub-grid interpolation
+        double train = 0;   // model update
+    };
+
+    static constexpr unsigned max_train_interval = 10;
+
+    // Forgets learned costs and returns to full effort. parallel_width is
+    // the number of contexts evaluated concurrently.
+    void reset(unsigned num_scales, unsigned num_angles, unsigned parallel_width = 1);
+    // Returns to full effort, e.g. when the governor is switched off
+    void full_effort();
+    const Decision &decide(double target_ms);
+    // Feeds the governor with stage durations of the last frame.
+    // measured.context is the time of all num_rounds rounds of context evaluation
+    // in the frame, see rounds().
+    void update(const Costs &measured, unsigned num_rounds, bool subgrid, bool trained);
+
+    // Number of rounds needed to evaluate the given number of contexts at once
+    unsigned rounds(unsigned contexts) const { return (contexts + m_parallel_width - 1) / m_parallel_width; }
+
+    const Decision &decision() const { return m_decision; }
+    const Costs &costs() const { return m_costs; }
+
+private:
+    static constexpr double smoothing = 0.1; // weight of new measurements
+    static constexpr double headroom = 0.9;  // fraction of the target used for planning
+
+    unsigned m_max_scale_radius = 0, m_max_angle_radius = 0;
+    unsigned m_parallel_width = 1;
+    Costs m_costs;
+    bool m_have_context = false, m_have_subgrid = false, m_have_train = false;
+    bool m_have_base = false;
+    Decision m_decision;
+};
+
+#endif // GOVERNOR_H
@@ -7,7 +7,11 @@
 #include <algorithm>
 #include "threadctx.hpp"
 #include "debug.h"
+#include "metrics.h"
 #include <limits>
+#include <map>
+#include <mutex>
+#include <stdexcept>
 #include <opencv/highgui.h>
 #include <opencv2/gapi.hpp>
 #include <opencv2/gapi/core.hpp>
@@ -53,26 +57,31 @@ class Kcf_Tracker_Private {
     Kcf_Tracker_Private(const KCF_Tracker &kcf) : kcf(kcf) {}
 
     const KCF_Tracker &kcf;
-#ifdef BIG_BATCH
+
+    // Location of a scale/angle combination in threadctxs. Every
+    // ThreadCtx evaluates one combination.
+    struct Context {
+        ThreadCtx *ctx;
+        uint idx; // index within ctx
+        ThreadCtx::Max &max() const { return ctx->max[idx]; }
+        cv::UMat &spectrum() const { return ctx->spectrum(idx); }
+    };
+
     std::vector<ThreadCtx> threadctxs;
-#else
-    ScaleRotVector<ThreadCtx> threadctxs{kcf.p_scales, kcf.p_angles};
-#endif
+    ScaleRotVector<Context> contexts{kcf.p_scales, kcf.p_angles};
 };
 
 KCF_Tracker::KCF_Tracker(double padding, double kernel_sigma, double lambda, double interp_factor,
                          double output_sigma_factor, int cell_size)
-    : p_cell_size(cell_size), fft(*new FFT()), p_padding(padding), p_output_sigma_factor(output_sigma_factor), p_kernel_sigma(kernel_sigma),
+    : p_cell_size(cell_size), fft(new FFT()), p_output_sigma_factor(output_sigma_factor), p_kernel_sigma(kernel_sigma),
       p_lambda(lambda), p_interp_factor(interp_factor)
 {
+    m_config.padding = padding;
 }
 
-KCF_Tracker::KCF_Tracker() : fft(*new FFT()) {}
+KCF_Tracker::KCF_Tracker() : fft(new FFT()) {}
 
-KCF_Tracker::~KCF_Tracker()
-{
-    delete &fft;
-}
+KCF_Tracker::~KCF_Tracker() {}
 
 void KCF_Tracker::train(cv::UMat input_rgb, cv::UMat input_gray, double interp_factor)
 {
@@ -86,9 +95,39 @@ void KCF_Tracker::train(cv::UMat input_rgb, cv::UMat input_gray, double interp_f
                  p_current_scale, p_current_angle).getUMat(cv::ACCESS_RW).copyTo(MatUtil::scale(0, model->patch_feats));
             
     DEBUG_PRINT(model->patch_feats);    
-    fft.forward_window(model->patch_feats, model->xf, model->temp);
+    fft->forward_window(model->patch_feats, model->xf, model->temp);
     DEBUG_PRINTM(model->xf);
-    
+
+    update_model(interp_factor);
+}
+
+// Uses spectrum zf of a detection window as the training sample. The
+// window is shifted by 'shift' feature cells to the new target position
+// by multiplying the spectrum with exp(2*pi*i*(kx*dx/W + ky*dy/H)).
+void KCF_Tracker::train_spectrum(cv::UMat &zf, cv::Point2d shift, double interp_factor)
+{
+    TRACE("");
+
+    cv::Size sz(Fft::freq_size(feature_size));
+    cv::Mat phase(sz, CV_32FC2);
+    for (int y = 0; y < sz.height; ++y) {
+        // negative frequencies are stored in the upper half of the spectrum
+        int ky = y > feature_size.height / 2 ? y - feature_size.height : y;
+        for (int x = 0; x < sz.width; ++x) {
+            int kx = x > feature_size.width / 2 ? x - feature_size.width : x;
+            double arg = 2 * M_PI * (kx * shift.x / feature_size.width + ky * shift.y / feature_size.height);
+            phase.at<cv::Vec2f>(y, x) = cv::Vec2f(std::cos(arg), std::sin(arg));
+        }
+    }
+    cv::UMat phase_umat = phase.getUMat(cv::ACCESS_RW);
+    MatUtil::mul_matn_mat1(zf, phase_umat).copyTo(model->xf);
+    DEBUG_PRINTM(model->xf);
+
+    update_model(interp_factor);
+}
+
+void KCF_Tracker::update_model(double interp_factor)
+{
     cv::Mat tempModelXf = model->model_xf.getMat(cv::ACCESS_RW);
     cv::Mat tempXf = model->xf.getMat(cv::ACCESS_RW);
     
@@ -102,30 +141,204 @@ void KCF_Tracker::train(cv::UMat input_rgb, cv::UMat input_gray, double interp_f
     
     DEBUG_PRINTM(model->model_xf);
     
-    
-    if (m_use_linearkernel) {        
-        // Unused feature
-        
-//        cv::Mat xfconj = MatUtil::conj(model->xf);
-//        model->model_alphaf_num = MatUtil::mul_matn_mat1(xfconj, model->yf);
-//        model->model_alphaf_den = MatUtil::mul_matn_matn(model->xf, xfconj);
+    // Kernel Ridge Regression, calculate alphas (in Fourier domain)
+    cv::Size sz(Fft::freq_size(feature_size));
+    cv::UMat kf = cv::UMat(sz.height, sz.width, CV_32FC2);
+    if (m_config.alpha_update == KCF_Config::AlphaUpdate::INCREMENTAL) {
+        // Numerator and denominator are running averages of terms
+        // computed from the new sample only
+        (*gaussian_correlation)(kf, model->xf, model->xf, p_kernel_sigma, true, *this);
+        DEBUG_PRINTM(kf);
+        cv::UMat num = MatUtil::mul_matn_matn(model->yf, kf);
+        cv::UMat addedMat = MatUtil::add_scalar(kf, p_lambda);
+        cv::UMat den = MatUtil::mul_matn_matn(kf, addedMat);
+        cv::addWeighted(model->model_alphaf_num, 1. - interp_factor, num, interp_factor, 0., model->model_alphaf_num);
+        cv::addWeighted(model->model_alphaf_den, 1. - interp_factor, den, interp_factor, 0., model->model_alphaf_den);
     } else {
-        // Kernel Ridge Regression, calculate alphas (in Fourier domain)
-        cv::Size sz(Fft::freq_size(feature_size));
-        cv::UMat kf = cv::UMat(sz.height, sz.width, CV_32FC2);
         (*gaussian_correlation)(kf, model->model_xf, model->model_xf, p_kernel_sigma, true, *this);
-        DEBUG_PRINTM(kf);        
+        DEBUG_PRINTM(kf);
         model->model_alphaf_num = MatUtil::mul_matn_matn(model->yf, kf);
         cv::UMat addedMat = MatUtil::add_scalar(kf, p_lambda);
         model->model_alphaf_den = MatUtil::mul_matn_matn(kf, addedMat);
-
     }
+
     model->model_alphaf = MatUtil::divide_matn_matn(model->model_alphaf_num, model->model_alphaf_den);
     DEBUG_PRINTM(model->model_alphaf);
     //        p_model_alphaf = p_yf / (kf + p_lambda);   //equation for fast training
 
 }
 
+static const char *parallel_name(KCF_Config::Parallel p)
+{
+    switch (p) {
+    case KCF_Config::Parallel::AUTO:     return "auto";
+    case KCF_Config::Parallel::NONE:     return "none";
+    case KCF_Config::Parallel::CONTEXTS: return "contexts";
+    case KCF_Config::Parallel::FFT:      return "fft";
+    }
+    return "?";
+}
+
+// Chooses where to use multiple threads. Parallel contexts scale well as
+// long as there are enough of them for the cores, threaded FFTs pay off
+// only for large transforms.
+static KCF_Config::Parallel choose_parallel(KCF_Config::Parallel requested, unsigned cores, unsigned contexts,
+                                            cv::Size feature_size, bool threaded_fft)
+{
+    typedef KCF_Config::Parallel P;
+#if defined(OPENMP) || defined(ASYNC)
+    const bool parallel_contexts = true;
+#else
+    const bool parallel_contexts = false;
+#endif
+    const bool large_fft = feature_size.area() >= 64 * 64;
+
+    switch (requested) {
+    case P::AUTO:
+        if (cores <= 1)
+            return P::NONE;
+        if (threaded_fft && large_fft && (contexts < cores || !parallel_contexts))
+            return P::FFT;
+        if (parallel_contexts && contexts > 1)
+            return P::CONTEXTS;
+        return threaded_fft ? P::FFT : P::NONE;
+    case P::CONTEXTS:
+        if (!parallel_contexts)
+            throw std::runtime_error("Parallel contexts need OpenMP or ASYNC build");
+        break;
+    case P::FFT:
+        if (!threaded_fft)
+            throw std::runtime_error("Threaded FFT needs the FFTW backend");
+        break;
+    case P::NONE:
+        break;
+    }
+    return requested;
+}
+
+static bool is_smooth(int n)
+{
+    for (int p : {2, 3, 5})
+        while (n % p == 0)
+            n /= p;
+    return n == 1;
+}
+
+// Measures the transforms done for one context: forward transform of
+// 'channels' windowed feature channels and inverse transform of one
+// response. Plans are thrown away afterwards.
+static double fft_time(Fft &fft, cv::Size size, unsigned channels, FftOptions options)
+{
+    options.threads = 1;
+    options.probe = true;
+    fft.set_options(options);
+    fft.init(size.width, size.height, channels, 1);
+    fft.set_window(cv::UMat::ones(size, CV_32F));
+
+    const std::vector<int> feat_dims({1, int(channels), size.height, size.width});
+    cv::UMat feat(4, feat_dims.data(), CV_32F), temp(4, feat_dims.data(), CV_32F);
+    cv::UMat response(3, std::vector<int>({1, size.height, size.width}).data(), CV_32F);
+    cv::UMat complex(Fft::freq_size(size), CV_32FC(2 * channels));
+    cv::UMat response_f(Fft::freq_size(size), CV_32FC2);
+    cv::randu(feat, -1., 1.);
+    cv::randu(response_f, -1., 1.);
+
+    double best = std::numeric_limits<double>::max();
+    for (int i = 0; i < 5; ++i) {
+        int64 start = cv::getTickCount();
+        fft.forward_window(feat, complex, temp);
+        fft.inverse(response_f, response);
+        best = std::min(best, double(cv::getTickCount() - start) / cv::getTickFrequency());
+    }
+    return best;
+}
+
+// With fft=auto, the fixed-size kernels are used only if they were
+// measured to be faster than the native backend. The native plans are
+// created with the configured rigor, so FFTW remembers them for the
+// real planning. Each size is measured once per process.
+bool KCF_Tracker::use_fixed_fft(cv::Size size, unsigned channels) const
+{
+#ifdef CUFFT
+    (void)size;
+    (void)channels;
+    return false;
+#else
+    if (m_config.fft == KCF_Config::FftBackend::NATIVE || !FftFixed::supported(size))
+        return false;
+    if (m_config.fft == KCF_Config::FftBackend::FIXED)
+        return true;
+
+    static std::mutex mutex;
+    static std::map<std::tuple<int, int, unsigned>, bool> fixed_faster;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto key = std::make_tuple(size.width, size.height, channels);
+    auto it = fixed_faster.find(key);
+    if (it != fixed_faster.end())
+        return it->second;
+
+    FftFixed fixed;
+    FFT native;
+    double fixed_time = fft_time(fixed, size, channels, m_config.fft_options);
+    double native_time = fft_time(native, size, channels, m_config.fft_options);
+    std::cout << "init: fft=auto, " << size << ", " << channels << " channels: fixed-size "
+              << fixed_time * 1e6 << " us, native " << native_time * 1e6 << " us" << std::endl;
+    return fixed_faster[key] = fixed_time < native_time;
+#endif
+}
+
+// Selects feature size with only 2, 3 and 5 as prime factors whose
+// dimensions are within 'tolerance' (relative) from those of 'window'
+// in cells. Among up to three nearest candidates in each dimension, the
+// one with the lowest measured transform time per element is used.
+cv::Size KCF_Tracker::smooth_feature_size(cv::Size window, double tolerance) const
+{
+    auto candidates = [tolerance](int target) {
+        std::vector<int> ret;
+        int lo = std::max(1, int(std::ceil(target * (1. - tolerance))));
+        int hi = std::max(lo, int(std::floor(target * (1. + tolerance))));
+        for (int n = lo; n <= hi; ++n)
+            if (is_smooth(n))
+                ret.push_back(n);
+        if (ret.empty()) {
+            // Nearest smooth number outside of the tolerance
+            for (int d = 1; ret.empty(); ++d) {
+                if (target - d >= 1 && is_smooth(target - d))
+                    ret.push_back(target - d);
+                else if (is_smooth(target + d))
+                    ret.push_back(target + d);
+            }
+        }
+        std::sort(ret.begin(), ret.end(), [target](int a, int b) { return std::abs(a - target) < std::abs(b - target); });
+        if (ret.size() > 3)
+            ret.resize(3);
+        return ret;
+    };
+
+    // Plans are created with FFTW_ESTIMATE to keep this cheap
+    FftOptions estimate;
+    estimate.rigor = FftOptions::Rigor::ESTIMATE;
+
+    cv::Size target(window.width / p_cell_size, window.height / p_cell_size);
+    cv::Size best = target;
+    double best_cost = std::numeric_limits<double>::max();
+    for (int w : candidates(target.width)) {
+        for (int h : candidates(target.height)) {
+            cv::Size size(w, h);
+            if (m_config.fft == KCF_Config::FftBackend::FIXED && !FftFixed::supported(size))
+                continue;
+            std::unique_ptr<Fft> fft(use_fixed_fft(size, 1) ? static_cast<Fft *>(new FftFixed()) : new FFT());
+            double cost = fft_time(*fft, size, 1, estimate) / size.area();
+            if (cost < best_cost) {
+                best_cost = cost;
+                best = size;
+            }
+        }
+    }
+    return best;
+}
+
 static int round_pw2_down(int x)
 {
         for (int i = 1; i < 32; i <<= 1)
@@ -139,6 +352,11 @@ void KCF_Tracker::init(cv::UMat &img, const cv::Rect &bbox, int fit_size_x, int
 {
     __dbgTracer.debug = m_debug;
     TRACE("");
+
+    p_stats.inits++;
+    reset_read_region(img);
+    static Counter &inits = MetricsRegistry::global().counter("kcf_inits_total", "Tracker (re-)initializations");
+    inits.inc();
     
     // check boundary, enforce min size
     double x1 = bbox.x, x2 = bbox.x + bbox.width, y1 = bbox.y, y2 = bbox.y + bbox.height;
@@ -194,9 +412,9 @@ void KCF_Tracker::init(cv::UMat &img, const cv::Rect &bbox, int fit_size_x, int
     cv::UMat input_gray = tempGray.getUMat(cv::ACCESS_RW);
 
     // don't need too large image
-    if (p_init_pose.w * p_init_pose.h > 100. * 100.) {
+    p_resize_image = p_init_pose.w * p_init_pose.h > 100. * 100.;
+    if (p_resize_image) {
         std::cout << "resizing image by factor of " << 1 / p_downscale_factor << std::endl;
-        p_resize_image = true;
         p_init_pose.scale(p_downscale_factor);
         cv::GMat inRgb2;
         cv::GMat inGray2;
@@ -207,6 +425,7 @@ void KCF_Tracker::init(cv::UMat &img, const cv::Rect &bbox, int fit_size_x, int
     }
 
     // compute win size + fit to fhog cell size
+    p_padding = m_config.padding;
     p_windows_size.width = round(p_init_pose.w * (1. + p_padding) / p_cell_size) * p_cell_size;
     p_windows_size.height = round(p_init_pose.h * (1. + p_padding) / p_cell_size) * p_cell_size;
 
@@ -214,14 +433,40 @@ void KCF_Tracker::init(cv::UMat &img, const cv::Rect &bbox, int fit_size_x, int
         // Round down to the next highest power of 2
         fit_size = cv::Size(round_pw2_down(p_windows_size.width),
                             round_pw2_down(p_windows_size.height));
+    } else if ((fit_size_x == -1 || fit_size_y == -1) && m_config.fit_smooth > 0) {
+        fit_size = smooth_feature_size(p_windows_size, m_config.fit_smooth) * p_cell_size;
     } else if (fit_size_x == -1 || fit_size_y == -1) {
         fit_size =  p_windows_size;
     } else {
         fit_size = cv::Size(fit_size_x, fit_size_y);
     }
 
+    // Buffers allocated by the previous init() are reused if the geometry does not change
+    const cv::Size prev_feature_size = feature_size;
+    const int prev_num_of_feats = p_num_of_feats;
+    const std::vector<double> prev_scales = p_scales, prev_angles = p_angles;
+    const double prev_output_sigma = p_output_sigma;
+
     feature_size = fit_size / p_cell_size;
 
+    p_num_scales = m_config.num_scales;
+    p_scale_step = m_config.scale_step;
+    p_num_angles = m_config.num_angles;
+    p_angle_step = m_config.angle_step;
+    p_kernel = m_config.kernel;
+
+    // Color features need color input
+    bool use_color = m_config.color && img.channels() == 3;
+    bool use_cnfeat = m_config.cnfeat && img.channels() == 3;
+    if (use_color && use_cnfeat)
+        use_pipeline<true, true>();
+    else if (use_color)
+        use_pipeline<true, false>();
+    else if (use_cnfeat)
+        use_pipeline<false, true>();
+    else
+        use_pipeline<false, false>();
+
     p_scales.clear();
     for (int i = -int(p_num_scales - 1) / 2; i <= int(p_num_scales) / 2; ++i)
         p_scales.push_back(std::pow(p_scale_step, i));
@@ -231,29 +476,48 @@ void KCF_Tracker::init(cv::UMat &img, const cv::Rect &bbox, int fit_size_x, int
         p_angles.push_back(i * p_angle_step);
 
 #ifdef CUFFT
-    if (m_use_linearkernel) {
+    if (p_kernel == KCF_Config::Kernel::LINEAR) {
         std::cerr << "cuFFT supports only Gaussian kernel." << std::endl;
         std::exit(EXIT_FAILURE);
     }
 #endif
 
-    model.reset(new Model(feature_size, p_num_of_feats));
-    d.reset(new Kcf_Tracker_Private(*this));
-
-#ifndef BIG_BATCH
-    for (auto scale: p_scales)
-        for (auto angle : p_angles)
-            d->threadctxs.emplace_back(feature_size, (int)p_num_of_feats, scale, angle);
+#ifdef OPENMP
+    const unsigned cores = omp_get_max_threads();
 #else
-    d->threadctxs.emplace_back(feature_size, (int)p_num_of_feats, p_scales, p_angles);
+    const unsigned cores = std::max(1u, std::thread::hardware_concurrency());
 #endif
 
-    gaussian_correlation.reset(new GaussianCorrelation(1, p_num_of_feats, feature_size));
+    const bool same_geometry = model && feature_size == prev_feature_size && p_num_of_feats == prev_num_of_feats &&
+                               p_scales == prev_scales && p_angles == prev_angles;
+    if (same_geometry) {
+        // Only the model needs to be cleared, detection buffers are overwritten in every frame
+        model->model_xf.setTo(0);
+        model->model_alphaf.setTo(0);
+        model->model_alphaf_num.setTo(0);
+        model->model_alphaf_den.setTo(0);
+    } else {
+        model.reset(new Model(feature_size, p_num_of_feats));
+        d.reset(new Kcf_Tracker_Private(*this));
+
+        for (auto scale: p_scales)
+            for (auto angle : p_angles)
+                d->threadctxs.emplace_back(feature_size, (int)p_num_of_feats,
+                                           std::vector<double>{scale}, std::vector<double>{angle});
+        for (auto &ctx : d->threadctxs)
+            for (uint i = 0; i < ctx.max.size(); ++i)
+                d->contexts.push_back({&ctx, i});
+
+        gaussian_correlation.reset(new GaussianCorrelation(1, p_num_of_feats, feature_size));
+    }
 
     p_current_center = p_init_pose.center();
     p_current_scale = 1.;
     p_current_angle = 0.;
 
+    p_frames_since_train = 0;
+    p_motion.reset(m_config.motion, p_current_center, p_current_scale, p_current_angle);
+
     double min_size_ratio = std::max(5. * p_cell_size / p_windows_size.width, 5. * p_cell_size / p_windows_size.height);
     double max_size_ratio =
         std::min(floor((img.cols + p_windows_size.width / 3) / p_cell_size) * p_cell_size / p_windows_size.width,
@@ -272,18 +536,53 @@ void KCF_Tracker::init(cv::UMat &img, const cv::Rect &bbox, int fit_size_x, int
     p_output_sigma = std::sqrt(p_init_pose.w * p_init_pose.h * double(fit_size.area()) / p_windows_size.area())
            * p_output_sigma_factor / p_cell_size;
 
-    fft.init(feature_size.width, feature_size.height, p_num_of_feats, p_num_scales * p_num_angles);
-    fft.set_window(cosine_window_function(feature_size.width, feature_size.height).getUMat(cv::ACCESS_RW));
+#ifdef CUFFT
+    if (m_config.fft == KCF_Config::FftBackend::FIXED)
+        throw std::runtime_error("Fixed-size FFT cannot be used with cuFFT");
+#endif
+    if (m_config.fft == KCF_Config::FftBackend::FIXED && !FftFixed::supported(feature_size))
+        throw std::runtime_error("Fixed-size FFT supports only power-of-two sizes from 8 to 128");
+    const bool use_fixed = use_fixed_fft(feature_size, p_num_of_feats);
+#if defined(FFTW) && !defined(CUFFTW)
+    const bool threaded_fft = !use_fixed;
+#else
+    const bool threaded_fft = false;
+#endif
+    p_parallel = choose_parallel(m_config.parallel, cores, p_num_scales * p_num_angles, feature_size, threaded_fft);
+    std::cout << "init: parallelism: " << parallel_name(p_parallel) << " (" << cores << " cores)" << std::endl;
+    // Parallel contexts are evaluated by up to 'cores' threads at once
+    p_governor.reset(p_num_scales, p_num_angles, p_parallel == KCF_Config::Parallel::CONTEXTS ? cores : 1);
+
+    FftOptions fft_options = m_config.fft_options;
+    fft_options.threads = p_parallel == KCF_Config::Parallel::FFT ? cores : 1;
+
+    bool fft_changed = !same_geometry || fft_options != p_fft_options;
+    if (use_fixed && !dynamic_cast<FftFixed *>(fft.get())) {
+        fft.reset(new FftFixed());
+        fft_changed = true;
+    } else if (!use_fixed && !dynamic_cast<FFT *>(fft.get())) {
+        fft.reset(new FFT());
+        fft_changed = true;
+    }
+
+    if (fft_changed) {
+        p_fft_options = fft_options;
+        fft->set_options(p_fft_options);
+        fft->init(feature_size.width, feature_size.height, p_num_of_feats, p_num_scales * p_num_angles);
+        fft->set_window(cosine_window_function(feature_size.width, feature_size.height).getUMat(cv::ACCESS_RW));
+    }
 
     // window weights, i.e. labels
-    cv::Mat gsl(feature_size,CV_32F);
-    gaussian_shaped_labels(p_output_sigma, feature_size.width, feature_size.height).copyTo(gsl);
-    cv::UMat gslUmat = gsl.getUMat(cv::ACCESS_RW);
+    if (fft_changed || p_output_sigma != prev_output_sigma) {
+        cv::Mat gsl(feature_size,CV_32F);
+        gaussian_shaped_labels(p_output_sigma, feature_size.width, feature_size.height).copyTo(gsl);
+        cv::UMat gslUmat = gsl.getUMat(cv::ACCESS_RW);
 //gaussian_shaped_labels_umat(p_output_sigma, feature_size.width, feature_size.height).copyTo(gsl);
-    
-    fft.forward(gslUmat, model->yf);
-    
-    DEBUG_PRINTM(model->yf);
+
+        fft->forward(gslUmat, model->yf);
+
+        DEBUG_PRINTM(model->yf);
+    }
     
     // train initial model
     train(input_rgb, input_gray, 1.0);
@@ -301,6 +600,7 @@ void KCF_Tracker::updateTrackerPosition(BBox_c &bbox)
         tmp.scale(p_downscale_factor);
     }
     p_current_center = tmp.center();
+    p_motion.reset(p_motion.type(), p_current_center, p_current_scale, p_current_angle);
 }
 
 BBox_c KCF_Tracker::getBBox()
@@ -318,6 +618,28 @@ BBox_c KCF_Tracker::getBBox()
     return tmp;
 }
 
+void KCF_Tracker::reset_read_region(const cv::UMat &img)
+{
+    std::lock_guard<std::mutex> lock(p_read_mutex);
+    p_read_region = cv::Rect();
+    p_input_size = img.size();
+}
+
+cv::Rect KCF_Tracker::getReadRegion() const
+{
+    std::lock_guard<std::mutex> lock(p_read_mutex);
+    cv::Rect r = p_read_region;
+    if (r.area() > 0 && p_resize_image) {
+        // The downscaled pixels are computed from a neighbourhood of
+        // 1 / p_downscale_factor input pixels (INTER_AREA)
+        double f = 1. / p_downscale_factor;
+        int pad = int(std::ceil(f)) + 1;
+        r = cv::Rect(int(std::floor(r.x * f)) - pad, int(std::floor(r.y * f)) - pad,
+                     int(std::ceil(r.width * f)) + 2 * pad, int(std::ceil(r.height * f)) + 2 * pad);
+    }
+    return r & cv::Rect(cv::Point(0, 0), p_input_size);
+}
+
 double KCF_Tracker::getFilterResponse() const
 {
     return this->max_response;
@@ -356,42 +678,30 @@ static cv::Point2d wrapAroundFreq(cv::Point2d pt, cv::Mat &resp_map)
 double KCF_Tracker::findMaxReponse(uint &max_idx, cv::Point2d &new_location) const
 {
     double max;
-    const auto &vec = IF_BIG_BATCH(d->threadctxs[0].max, d->threadctxs);
-
-#ifndef BIG_BATCH
-    auto max_it = std::max_element(vec.begin(), vec.end(),
-                                   [](const ThreadCtx &a, const ThreadCtx &b)
-                                   { return a.max.response < b.max.response; });
-#else
-    auto max_it = std::max_element(vec.begin(), vec.end(),
-                                   [](const ThreadCtx::Max &a, const ThreadCtx::Max &b)
-                                   { return a.response < b.response; });
-#endif
-    assert(max_it != vec.end());
-    max = max_it->IF_BIG_BATCH(response, max.response);
-
-    max_idx = std::distance(vec.begin(), max_it);
-
-    cv::Point2i max_response_pt = IF_BIG_BATCH(max_it->loc, max_it->max.loc);
-//    cv::Mat max_response_map    = IF_BIG_BATCH(d->threadctxs[0].response.plane(max_idx),
-//                                               max_it->response.plane(0));
-    
-    cv::Mat tempResponse = IF_BIG_BATCH(cv::Mat(), max_it->response.getMat(cv::ACCESS_RW));
-    cv::Mat max_response_map = IF_BIG_BATCH(MatUtil::plane(max_idx, d->threadctxs[0].response.getMat(cv::ACCESS_RW)),
-                                               MatUtil::plane(0, tempResponse));
-    
+    const auto &grid = d->contexts;
+
+    // Contexts not evaluated in this frame compare less than evaluated ones
+    auto less = [](const Kcf_Tracker_Private::Context &a, const Kcf_Tracker_Private::Context &b) {
+        return b.max().valid && (!a.max().valid || a.max().response < b.max().response);
+    };
+    auto max_it = std::max_element(grid.begin(), grid.end(), less);
+    assert(max_it != grid.end());
+    assert(max_it->max().valid);
+    max = max_it->max().response;
+
+    max_idx = std::distance(grid.begin(), max_it);
+
+    cv::Point2i max_response_pt = max_it->max().loc;
+    cv::Mat tempResponse = max_it->ctx->response.getMat(cv::ACCESS_RW);
+    cv::Mat max_response_map = MatUtil::plane(max_it->idx, tempResponse);
     
     DEBUG_PRINTM(max_response_map);
     DEBUG_PRINT(max_response_pt);
 
     max_response_pt = wrapAroundFreq(max_response_pt, max_response_map);
 
-    // sub pixel quadratic interpolation from neighbours
-    if (m_use_subpixel_localization) {
-        new_location = sub_pixel_peak(max_response_pt, max_response_map);
-    } else {
-        new_location = max_response_pt;
-    }
+    // sub pixel quadratic interpolation from neighbours (zero when disabled)
+    new_location = cv::Point2d(max_response_pt) + max_it->max().subpixel;
     DEBUG_PRINT(new_location);
 
     if (m_visual_debug != vd::NONE) {
@@ -402,19 +712,17 @@ double KCF_Tracker::findMaxReponse(uint &max_idx, cv::Point2d &new_location) con
                               (w + 1) * p_num_angles - 1, CV_32FC3, cv::Scalar::all(0));
         for (size_t i = 0; i < p_num_scales; ++i) {
             for (size_t j = 0; j < p_num_angles; ++j) {
-                auto &threadctx = d->IF_BIG_BATCH(threadctxs[0], threadctxs(i, j));
+                const Kcf_Tracker_Private::Context &context = d->contexts(i, j);
                 cv::Mat tmp;
-                cv::Point2d cross = threadctx.IF_BIG_BATCH(max(i, j), max).loc;
+                cv::Point2d cross = context.max().loc;
                 cross = wrapAroundFreq(cross, max_response_map);
                 if (m_visual_debug == vd::PATCH ) {
-                    threadctx.dbg_patch IF_BIG_BATCH((i, j),)
+                    context.ctx->dbg_patch[context.idx]
                             .convertTo(tmp, all_responses.type(), 1.0 / 255);
                     cross.x = cross.x / fit_size.width  * tmp.cols + tmp.cols / 2;
                     cross.y = cross.y / fit_size.height * tmp.rows + tmp.rows / 2;
                 } else {
-//                    cv::cvtColor(threadctx.response.plane(IF_BIG_BATCH(threadctx.max.getIdx(i, j), 0)),
-//                            tmp, cv::COLOR_GRAY2BGR);
-                    cv::cvtColor(MatUtil::plane(IF_BIG_BATCH(threadctx.max.getIdx(i, j), 0), threadctx.response),
+                    cv::cvtColor(MatUtil::plane(context.idx, context.ctx->response),
                             tmp, cv::COLOR_GRAY2BGR);
                     tmp /= max; // Normalize to 1
                     cross += cv::Point2d(tmp.size())/2;
@@ -422,7 +730,7 @@ double KCF_Tracker::findMaxReponse(uint &max_idx, cv::Point2d &new_location) con
                     //drawCross(tmp, cross, false);
                 }
                 bool green = false;
-                if (&*max_it == &IF_BIG_BATCH(threadctx.max(i, j), threadctx)) {
+                if (&*max_it == &context) {
                     // Show the green cross at position of sub-pixel interpolation (if enabled)
                     cross = new_location + cv::Point2d(tmp.size())/2;
                     green = true;
@@ -443,11 +751,138 @@ double KCF_Tracker::findMaxReponse(uint &max_idx, cv::Point2d &new_location) con
     return max;
 }
 
+static double ms_since(int64 start)
+{
+    return (cv::getTickCount() - start) * 1000. / cv::getTickFrequency();
+}
+
+uint KCF_Tracker::track_contexts(const std::vector<uint> &ctx_idx, cv::UMat &input_rgb, cv::UMat &input_gray)
+{
+#if defined(ASYNC)
+    const bool parallel = p_parallel == KCF_Config::Parallel::CONTEXTS;
+    for (uint i : ctx_idx) {
+        auto &it = d->threadctxs[i];
+        it.async_res = std::async(parallel ? std::launch::async : std::launch::deferred,
+                                  [this, &input_gray, &input_rgb, &it]() -> void {
+            it.track(*this, input_rgb, input_gray);
+        });
+    }
+    for (uint i : ctx_idx)
+        d->threadctxs[i].async_res.wait();
+    return ctx_idx.size();
+#else
+    CONTEXTS_OMP_PARALLEL_FOR_IF(p_parallel == KCF_Config::Parallel::CONTEXTS)
+    for (uint i = 0; i < ctx_idx.size(); ++i)
+        d->threadctxs[ctx_idx[i]].track(*this, input_rgb, input_gray);
+    return ctx_idx.size();
+#endif
+}
+
+uint KCF_Tracker::search_contexts(const LatencyGovernor::Decision &effort, cv::UMat &input_rgb, cv::UMat &input_gray,
+                                  uint &rounds)
+{
+    auto &grid = d->contexts;
+    auto valid = [&grid](uint idx) -> bool & { return grid[idx].max().valid; };
+
+    for (uint i = 0; i < grid.size(); ++i)
+        valid(i) = false;
+
+    // Part of the search grid allowed by the latency governor
+    const uint sc = (p_num_scales - 1) / 2, ac = (p_num_angles - 1) / 2;
+    const uint s_lo = sc - std::min(sc, effort.scale_radius);
+    const uint s_hi = effort.scale_radius >= sc ? p_num_scales - 1 : sc + effort.scale_radius;
+    const uint a_lo = ac - std::min(ac, effort.angle_radius);
+    const uint a_hi = effort.angle_radius >= ac ? p_num_angles - 1 : ac + effort.angle_radius;
+
+    std::vector<uint> ctx_idx;
+    uint evaluated = 0;
+    rounds = 0;
+    // Each call evaluates ctx_idx at once, which takes one or more rounds
+    auto track_ctx_idx = [&]() {
+        uint n = track_contexts(ctx_idx, input_rgb, input_gray);
+        rounds += p_governor.rounds(n);
+        return n;
+    };
+
+    if (m_config.early_exit_psr > 0 || m_config.early_exit_response > 0) {
+        // Evaluate the (scale=1, angle=0) context first and stop if it is
+        // confident enough and the peak is well inside the window
+        const uint centre = grid.getIdx(sc, ac);
+        ctx_idx.push_back(centre);
+        evaluated += track_ctx_idx();
+
+        const ThreadCtx::Max &m = grid[centre].max();
+        cv::Point2i peak = m.loc;
+        if (peak.x > feature_size.width / 2)
+            peak.x -= feature_size.width;
+        if (peak.y > feature_size.height / 2)
+            peak.y -= feature_size.height;
+        bool inside = std::abs(peak.x) <= feature_size.width / 4 && std::abs(peak.y) <= feature_size.height / 4;
+        bool confident = (m_config.early_exit_psr > 0 && m.psr >= m_config.early_exit_psr) ||
+                         (m_config.early_exit_response > 0 && m.response >= m_config.early_exit_response);
+        if (inside && confident) {
+            p_frame_stats.early_exit = true;
+            return evaluated;
+        }
+    }
+
+    if (m_config.search == KCF_Config::Search::FULL) {
+        // Usually tracks 15 scale/angle combinations
+        ctx_idx.clear();
+        for (uint s = s_lo; s <= s_hi; ++s)
+            for (uint a = a_lo; a <= a_hi; ++a)
+                if (!valid(grid.getIdx(s, a)))
+                    ctx_idx.push_back(grid.getIdx(s, a));
+        return evaluated + track_ctx_idx();
+    }
+
+    // Local search: evaluate the centre context, i.e. the scale and angle
+    // of the previous winner, and its direct neighbours. If a neighbour
+    // wins, continue from it. The final winner has all its neighbours
+    // evaluated as needed by sub-grid interpolation.
+    uint s = sc, a = ac;
+
+    auto add = [&](int si, int ai) {
+        if (si < int(s_lo) || si > int(s_hi) || ai < int(a_lo) || ai > int(a_hi))
+            return;
+        uint idx = grid.getIdx(si, ai);
+        if (!valid(idx))
+            ctx_idx.push_back(idx);
+    };
+
+    while (true) {
+        ctx_idx.clear();
+        add(s, a);
+        add(int(s) - 1, a);
+        add(int(s) + 1, a);
+        add(s, int(a) - 1);
+        add(s, int(a) + 1);
+        if (ctx_idx.empty())
+            break;
+        evaluated += track_ctx_idx();
+
+        uint best = grid.getIdx(s, a);
+        for (uint i = 0; i < grid.size(); ++i)
+            if (valid(i) && grid[i].max().response > grid[best].max().response)
+                best = i;
+        if (best == grid.getIdx(s, a))
+            break;
+        s = grid.getScaleIdx(best);
+        a = grid.getAngleIdx(best);
+    }
+    return evaluated;
+}
+
 void KCF_Tracker::track(cv::UMat &img)
 {
     __dbgTracer.debug = m_debug;
     TRACE("");
 
+    int64 t_start = cv::getTickCount();
+    KCF_FrameStats &stats = p_frame_stats;
+    stats = KCF_FrameStats();
+    reset_read_region(img);
+
     cv::UMat input_rgb = img.clone();
     cv::Mat tempRgb = input_rgb.getMat(cv::ACCESS_RW);
     cv::Mat tempGray;
@@ -468,27 +903,45 @@ void KCF_Tracker::track(cv::UMat &img)
     // don't need too large image
     resizeImgs(input_rgb, input_gray);
 
-#ifdef ASYNC
-    for (auto &it : d->threadctxs)
-        it.async_res = std::async(std::launch::async, [this, &input_gray, &input_rgb, &it]() -> void {
-            it.track(*this, input_rgb, input_gray);
-        });
-    for (auto const &it : d->threadctxs)
-        it.async_res.wait();
-
-#else  // !ASYNC
-        
-    // Usually tracks 15 scale/angle combinations
-    NORMAL_OMP_PARALLEL_FOR
-    for (uint i = 0; i < d->threadctxs.size(); ++i)
-        d->threadctxs[i].track(*this, input_rgb, input_gray);
-#endif
+    // center the search window at the predicted pose
+    p_motion.predict(p_current_center, p_current_scale, p_current_angle);
+    clamp2(p_current_center.x, 0.0, input_rgb.cols - 1.0);
+    clamp2(p_current_center.y, 0.0, input_rgb.rows - 1.0);
+    clamp2(p_current_scale, p_min_max_scale[0], p_min_max_scale[1]);
+    stats.t_preprocess = ms_since(t_start);
+
+    if (m_config.target_latency > 0)
+        p_governor.decide(m_config.target_latency);
+    else
+        p_governor.full_effort();
+    const LatencyGovernor::Decision &effort = p_governor.decision();
+
+    auto &grid = d->contexts;
+
+    int64 t_detect = cv::getTickCount();
+    uint rounds;
+    stats.contexts_evaluated = search_contexts(effort, input_rgb, input_gray, rounds);
+    stats.t_detect = ms_since(t_detect);
+
+    int64 t_localize = cv::getTickCount();
+    double t_subgrid = 0;
+    const bool subgrid = effort.subgrid && (m_config.subgrid_angle || m_config.subgrid_scale);
 
     cv::Point2d new_location;
     uint max_idx;
     max_response = findMaxReponse(max_idx, new_location);
-    double angle_change = m_use_subgrid_angle ? sub_grid_angle(max_idx)
-                                              : d->IF_BIG_BATCH(threadctxs[0].max, threadctxs).angle(max_idx);
+    max_psr = grid[max_idx].max().psr;
+    stats.psr = max_psr;
+
+    // Pose of the winning detection window and the peak position in it
+    const cv::Point2d peak = new_location;
+    const double window_scale = p_current_scale * grid.scale(max_idx);
+    const double window_angle = p_current_angle + grid.angle(max_idx);
+
+    int64 t_subgrid_start = cv::getTickCount();
+    double angle_change = m_config.subgrid_angle && effort.subgrid ? sub_grid_angle(max_idx)
+                                                                   : grid.angle(max_idx);
+    t_subgrid += ms_since(t_subgrid_start);
     p_current_angle += angle_change;
 
     new_location.x = new_location.x * cos(-p_current_angle/180*M_PI) + new_location.y * sin(-p_current_angle/180*M_PI);
@@ -499,21 +952,218 @@ void KCF_Tracker::track(cv::UMat &img)
 
     p_current_center += p_current_scale * p_cell_size * new_location;
 
+    const cv::Point2d unclamped_center = p_current_center;
     clamp2(p_current_center.x, 0.0, img.cols - 1.0);
     clamp2(p_current_center.y, 0.0, img.rows - 1.0);
 
     // sub grid scale interpolation
-    if (m_use_subgrid_scale) {
+    t_subgrid_start = cv::getTickCount();
+    if (m_config.subgrid_scale && effort.subgrid) {
         p_current_scale *= sub_grid_scale(max_idx);
     } else {
-        p_current_scale *= d->IF_BIG_BATCH(threadctxs[0].max, threadctxs).scale(max_idx);
+        p_current_scale *= grid.scale(max_idx);
     }
+    t_subgrid += ms_since(t_subgrid_start);
 
     clamp2(p_current_scale, p_min_max_scale[0], p_min_max_scale[1]);
-
+    p_motion.correct(p_current_center, p_current_scale, p_current_angle);
+    stats.t_localize = ms_since(t_localize);
 
     // train at newly estimated target position
-    train(input_rgb, input_gray, p_interp_factor);
+    int64 t_train = cv::getTickCount();
+    ++p_frames_since_train;
+    if (p_frames_since_train < effort.train_interval)
+        stats.train_skip = KCF_FrameStats::TrainSkip::INTERVAL;
+    else if (m_config.train_min_psr > 0 && max_psr < m_config.train_min_psr)
+        stats.train_skip = KCF_FrameStats::TrainSkip::LOW_CONFIDENCE;
+    else if (m_config.train_skip_response > 0 && max_response >= m_config.train_skip_response &&
+             p_frames_since_train <= m_config.train_max_skip)
+        stats.train_skip = KCF_FrameStats::TrainSkip::REDUNDANT;
+
+    if (stats.train_skip == KCF_FrameStats::TrainSkip::NONE) {
+        // The winning window differs from the new pose only by a small shift
+        bool reuse = m_config.reuse_features &&
+                     std::abs(peak.x) <= m_config.reuse_max_shift && std::abs(peak.y) <= m_config.reuse_max_shift &&
+                     std::abs(p_current_scale / window_scale - 1.) <= m_config.reuse_max_scale &&
+                     std::abs(p_current_angle - window_angle) <= m_config.reuse_max_angle &&
+                     unclamped_center == p_current_center;
+        if (reuse)
+            train_spectrum(grid[max_idx].spectrum(), peak, p_interp_factor);
+        else
+            train(input_rgb, input_gray, p_interp_factor);
+        stats.reused_features = reuse;
+        p_frames_since_train = 0;
+        stats.trained = true;
+    }
+    stats.t_train = ms_since(t_train);
+    stats.latency = ms_since(t_start);
+
+    LatencyGovernor::Costs measured;
+    measured.base = stats.t_preprocess + stats.t_localize - t_subgrid;
+    measured.context = stats.t_detect;
+    measured.subgrid = t_subgrid;
+    measured.train = stats.t_train;
+    p_governor.update(measured, rounds, subgrid, stats.trained);
+    record_stats();
+}
+
+namespace {
+// Metrics of all trackers in the process, see metrics.h
+struct TrackerMetrics {
+    MetricsRegistry &r = MetricsRegistry::global();
+    const std::vector<double> ms_buckets = Histogram::exponential(0.125, 2, 12);
+    const char *stage_help = "Duration of tracking stages per frame";
+
+    Histogram &t_preprocess = r.histogram("kcf_stage_duration_ms{stage=\"preprocess\"}", stage_help, ms_buckets);
+    Histogram &t_detect = r.histogram("kcf_stage_duration_ms{stage=\"detect\"}", stage_help, ms_buckets);
+    Histogram &t_localize = r.histogram("kcf_stage_duration_ms{stage=\"localize\"}", stage_help, ms_buckets);
+    Histogram &t_train = r.histogram("kcf_stage_duration_ms{stage=\"train\"}", stage_help, ms_buckets);
+    Histogram &latency = r.histogram("kcf_stage_duration_ms{stage=\"frame\"}", stage_help, ms_buckets);
+    Histogram &response = r.histogram("kcf_peak_response", "Peak of the winning filter response",
+                                      Histogram::linear(0.1, 0.1, 10));
+    Histogram &psr = r.histogram("kcf_psr", "Peak-to-sidelobe ratio of the winning filter response",
+                                 Histogram::exponential(2, 1.5, 10));
+
+    Counter &frames = r.counter("kcf_frames_total", "Frames tracked");
+    Counter &contexts = r.counter("kcf_contexts_evaluated_total", "Scale/angle contexts evaluated");
+    Counter &early_exits = r.counter("kcf_early_exits_total", "Frames where only the centre context was evaluated");
+    Counter &trained = r.counter("kcf_trainings_total", "Model updates");
+    Counter &reused = r.counter("kcf_reused_features_total", "Model updates from the detection features");
+    const char *skip_help = "Model updates skipped";
+    Counter &skip_interval = r.counter("kcf_trainings_skipped_total{reason=\"interval\"}", skip_help);
+    Counter &skip_low = r.counter("kcf_trainings_skipped_total{reason=\"low_confidence\"}", skip_help);
+    Counter &skip_redundant = r.counter("kcf_trainings_skipped_total{reason=\"redundant\"}", skip_help);
+};
+}
+
+void KCF_Tracker::record_stats()
+{
+    static TrackerMetrics m;
+    const KCF_FrameStats &f = p_frame_stats;
+
+    p_stats.frames++;
+    p_stats.contexts_evaluated += f.contexts_evaluated;
+    p_stats.early_exits += f.early_exit;
+    p_stats.trainings += f.trained;
+    p_stats.trainings_skipped += f.train_skip != KCF_FrameStats::TrainSkip::NONE;
+    p_stats.reused_features += f.reused_features;
+    p_stats.t_preprocess += f.t_preprocess;
+    p_stats.t_detect += f.t_detect;
+    p_stats.t_localize += f.t_localize;
+    p_stats.t_train += f.t_train;
+    p_stats.latency += f.latency;
+
+    m.t_preprocess.observe(f.t_preprocess);
+    m.t_detect.observe(f.t_detect);
+    m.t_localize.observe(f.t_localize);
+    m.t_train.observe(f.t_train);
+    m.latency.observe(f.latency);
+    m.response.observe(max_response);
+    m.psr.observe(f.psr);
+    m.frames.inc();
+    m.contexts.inc(f.contexts_evaluated);
+    m.early_exits.inc(f.early_exit);
+    m.trained.inc(f.trained);
+    m.reused.inc(f.reused_features);
+    switch (f.train_skip) {
+    case KCF_FrameStats::TrainSkip::NONE:
+        break;
+    case KCF_FrameStats::TrainSkip::INTERVAL:
+        m.skip_interval.inc();
+        break;
+    case KCF_FrameStats::TrainSkip::LOW_CONFIDENCE:
+        m.skip_low.inc();
+        break;
+    case KCF_FrameStats::TrainSkip::REDUNDANT:
+        m.skip_redundant.inc();
+        break;
+    }
+}
+
+// Analyzes the response produced by an unnormalized inverse FFT in a
+// single pass: finds the peak and accumulates the sums needed for the
+// peak-to-sidelobe ratio. The sidelobe is the (circular) response
+// outside of the 11x11 window around the peak; the window is subtracted
+// from the sums afterwards. PSR and the sub-pixel offset do not depend
+// on the scaling of the response, so 'norm' (the FFT normalization) is
+// applied to the peak value only.
+static void analyze_response(const cv::Mat &response, double norm, bool subpixel, double min_det,
+                             ThreadCtx::Max &max)
+{
+    const int rows = response.rows, cols = response.cols;
+    float peak_val = -std::numeric_limits<float>::infinity();
+    cv::Point2i peak(0, 0);
+    double sum = 0., sum_sqr = 0.;
+
+    for (int y = 0; y < rows; ++y) {
+        const float *row = response.ptr<float>(y);
+        float row_sum = 0.f, row_sqr = 0.f, row_max = row[0];
+        for (int x = 0; x < cols; ++x) {
+            row_sum += row[x];
+            row_sqr += row[x] * row[x];
+            row_max = std::max(row_max, row[x]);
+        }
+        sum += row_sum;
+        sum_sqr += row_sqr;
+        if (row_max > peak_val) {
+            peak_val = row_max;
+            peak = cv::Point2i(int(std::find(row, row + cols, row_max) - row), y);
+        }
+    }
+
+    auto at = [&response, rows, cols](int y, int x) -> float {
+        return response.at<float>((y + rows) % rows, (x + cols) % cols);
+    };
+
+    // Remove the peak window from the sums
+    const int r = 5;
+    const int wy = std::min(2 * r + 1, rows), wx = std::min(2 * r + 1, cols);
+    const int y0 = wy == rows ? 0 : peak.y - r, x0 = wx == cols ? 0 : peak.x - r;
+    for (int i = 0; i < wy; ++i) {
+        for (int j = 0; j < wx; ++j) {
+            float v = at(y0 + i, x0 + j);
+            sum -= v;
+            sum_sqr -= v * v;
+        }
+    }
+    const int n = rows * cols - wy * wx;
+
+    max.loc = peak;
+    max.response = peak_val * norm;
+    max.psr = 0.;
+    if (n > 0) {
+        double mean = sum / n;
+        double stddev = std::sqrt(std::max(sum_sqr / n - mean * mean, 0.));
+        if (stddev > 0.)
+            max.psr = (peak_val - mean) / stddev;
+    }
+
+    // Least squares fit of f(u, v) = a*u^2 + b*u*v + c*v^2 + d*u + e*v + g
+    // to the 3x3 neighbourhood of the peak. On this grid, the normal
+    // equations have a closed-form solution.
+    max.subpixel = cv::Point2d(0., 0.);
+    if (!subpixel)
+        return;
+    double f[3][3]; // f[v + 1][u + 1]
+    for (int v = -1; v <= 1; ++v)
+        for (int u = -1; u <= 1; ++u)
+            f[v + 1][u + 1] = at(peak.y + v, peak.x + u) * norm;
+    double col[3], row[3]; // sums over columns (u) and rows (v)
+    for (int k = 0; k < 3; ++k) {
+        col[k] = f[0][k] + f[1][k] + f[2][k];
+        row[k] = f[k][0] + f[k][1] + f[k][2];
+    }
+    const double a = (col[2] + col[0] - 2 * col[1]) / 6;
+    const double c = (row[2] + row[0] - 2 * row[1]) / 6;
+    const double b = (f[2][2] - f[0][2] - f[2][0] + f[0][0]) / 4;
+    const double d = (col[2] - col[0]) / 6;
+    const double e = (row[2] - row[0]) / 6;
+    const double det = 4 * a * c - b * b;
+    if (det > min_det) {
+        cv::Point2d offset((b * e - 2 * c * d) / det, (b * d - 2 * a * e) / det);
+        if (std::abs(offset.x) <= 1 && std::abs(offset.y) <= 1)
+            max.subpixel = offset;
+    }
 }
 
 void ThreadCtx::track(const KCF_Tracker &kcf, cv::UMat &input_rgb, cv::UMat &input_gray)
@@ -522,32 +1172,34 @@ void ThreadCtx::track(const KCF_Tracker &kcf, cv::UMat &input_rgb, cv::UMat &inp
     
     cv::Mat tempRgb = input_rgb.getMat(cv::ACCESS_RW);
     cv::Mat tempGray = input_gray.getMat(cv::ACCESS_RW);
+    const uint n = max.size();
     
-    BIG_BATCH_OMP_PARALLEL_FOR
-    for (uint i = 0; i < IF_BIG_BATCH(max.size(), 1); ++i)
-    {
-        kcf.get_features(tempRgb, tempGray, &dbg_patch IF_BIG_BATCH([i],),
+    for (uint i = 0; i < n; ++i) {
+        kcf.get_features(tempRgb, tempGray, &dbg_patch[i],
                          kcf.p_current_center.x, kcf.p_current_center.y,
                          kcf.p_windows_size.width, kcf.p_windows_size.height,
-                         kcf.p_current_scale * IF_BIG_BATCH(max.scale(i), scale),
-                         kcf.p_current_angle + IF_BIG_BATCH(max.angle(i), angle))
+                         kcf.p_current_scale * max.scale(i),
+                         kcf.p_current_angle + max.angle(i))
                 .getUMat(cv::ACCESS_RW)
-                .copyTo(MatUtil::scale(i, patch_feats));
-        DEBUG_PRINT(MatUtil::scale(i, patch_feats));
-    }
-    
-    kcf.fft.forward_window(patch_feats, zf, temp);
-    DEBUG_PRINTM(zf);
-    
-    if (kcf.m_use_linearkernel) {
-        // Unused feature
-    } else {
-        gaussian_correlation(kzf, zf, kcf.model->model_xf, kcf.p_kernel_sigma, false, kcf);
-        DEBUG_PRINTM(kzf);
-        kzf = MatUtil::mul_matn_mat1(kzf, kcf.model->model_alphaf);
+                .copyTo(MatUtil::scale(0, patch_feats[i]));
+        DEBUG_PRINT(MatUtil::scale(0, patch_feats[i]));
+
+        kcf.fft->forward_window(patch_feats[i], zf[i], temp);
+        DEBUG_PRINTM(zf[i]);
+
+        gaussian_correlation(kzf_ctx, zf[i], kcf.model->model_xf, kcf.p_kernel_sigma, false, kcf);
+        DEBUG_PRINTM(kzf_ctx);
+        if (n == 1) {
+            kzf = MatUtil::mul_matn_mat1(kzf_ctx, kcf.model->model_alphaf);
+        } else {
+            kzf_ctx = MatUtil::mul_matn_mat1(kzf_ctx, kcf.model->model_alphaf);
+            MatUtil::set_channel(0, int(2 * i), kzf_ctx, kzf);
+            MatUtil::set_channel(1, int(2 * i + 1), kzf_ctx, kzf);
+        }
     }
     DEBUG_PRINTM(kzf);
-    kcf.fft.inverse(kzf, response);
+    // The normalization is folded into analyze_response()
+    kcf.fft->inverse(kzf, response, false);
     DEBUG_PRINTM(response);
     
     /* target location is at the maximum response. we must take into
@@ -555,34 +1207,36 @@ void ThreadCtx::track(const KCF_Tracker &kcf, cv::UMat &input_rgb, cv::UMat &inp
     will appear at the top-left corner, not at the center (this is
     discussed in the paper). the responses wrap around cyclically. */
     
-    double min_val, max_val;
-    cv::Point2i min_loc, max_loc;
-#ifdef BIG_BATCH
-    for (size_t i = 0; i < max.size(); ++i) {
-        cv::minMaxLoc(MatUtil::plane(i, response), &min_val, &max_val, &min_loc, &max_loc);
-        DEBUG_PRINT(max_loc);
+    const double norm = 1. / roi.area();
+    cv::Mat resp = response.getMat(cv::ACCESS_READ);
+    for (uint i = 0; i < n; ++i) {
+        //  EDIT HERE to change which data (response) is used for determining best match of the tracking rectangle
+        analyze_response(MatUtil::plane(i, resp), norm, kcf.m_config.subpixel_localization,
+                         KCF_Tracker::p_floating_error, max[i]);
+        DEBUG_PRINT(max[i].loc);
+        DEBUG_PRINT(max[i].psr);
+
         double weight = max.scale(i) < 1. ? max.scale(i) : 1. / max.scale(i);
-        max[i].response = max_val * weight;
-        max[i].loc = max_loc;
+        max[i].response *= weight;
+        max[i].valid = true;
     }
-#else    
-      
-    //  EDIT HERE to change which data (response) is used for determining best match of the tracking rectangle
-    cv::minMaxLoc(MatUtil::plane(0, response), &min_val, &max_val, &min_loc, &max_loc);
-    DEBUG_PRINT(max_loc);
-    DEBUG_PRINT(max_val);
-
-    double weight = scale < 1. ? scale : 1. / scale;
-    max.response = max_val * weight;
-    max.loc = max_loc;
-#endif
 }
 
 // ****************************************************************************
 
-cv::Mat KCF_Tracker::get_features(cv::Mat &input_rgb, cv::Mat &input_gray, cv::Mat *dbg_patch,
-                                  int cx, int cy, int size_x, int size_y, double scale, double angle) const
+template <bool RGB, bool CN>
+void KCF_Tracker::use_pipeline()
 {
+    p_get_features = &KCF_Tracker::get_features_impl<RGB, CN>;
+    p_num_of_feats = FeatureSet<RGB, CN>::num_feats;
+}
+
+template <bool RGB, bool CN>
+cv::Mat KCF_Tracker::get_features_impl(cv::Mat &input_rgb, cv::Mat &input_gray, cv::Mat *dbg_patch,
+                                       int cx, int cy, int size_x, int size_y, double scale, double angle) const
+{
+    assert(!(RGB || CN) || input_rgb.channels() == 3);
+
     cv::Size scaled = cv::Size(floor(size_x * scale), floor(size_y * scale));
 
     cv::Mat patch_gray = get_subwindow(input_gray, cx, cy, scaled.width, scaled.height, angle);
@@ -606,7 +1260,7 @@ cv::Mat KCF_Tracker::get_features(cv::Mat &input_rgb, cv::Mat &input_gray, cv::M
 
     // get color rgb features (simple r,g,b channels)
     std::vector<cv::Mat> color_feat;
-    if ((m_use_color || m_use_cnfeat) && input_rgb.channels() == 3) {
+    if (RGB || CN) {
         // resize to default size
         cv::GMat rszIn2;
         cv::GMat rszOut2;
@@ -623,7 +1277,7 @@ cv::Mat KCF_Tracker::get_features(cv::Mat &input_rgb, cv::Mat &input_gray, cv::M
     if (dbg_patch)
         patch_rgb.copyTo(*dbg_patch);
 
-    if (m_use_color && input_rgb.channels() == 3) {
+    if (RGB) {
         // use rgb color space
         cv::Mat patch_rgb_norm;
         patch_rgb.convertTo(patch_rgb_norm, CV_32F, 1. / 255., -0.5);
@@ -635,16 +1289,18 @@ cv::Mat KCF_Tracker::get_features(cv::Mat &input_rgb, cv::Mat &input_gray, cv::M
         color_feat.insert(color_feat.end(), rgb.begin(), rgb.end());
     }
 
-    if (m_use_cnfeat && input_rgb.channels() == 3) {
+    if (CN) {
         std::vector<cv::Mat> cn_feat = CNFeat::extract(patch_rgb);
         color_feat.insert(color_feat.end(), cn_feat.begin(), cn_feat.end());
     }
 
     hog_feat.insert(hog_feat.end(), color_feat.begin(), color_feat.end());
 
-    int size[] = {p_num_of_feats, feature_size.height, feature_size.width};
+    const int num_feats = FeatureSet<RGB, CN>::num_feats;
+    assert(int(hog_feat.size()) == num_feats);
+    int size[] = {num_feats, feature_size.height, feature_size.width};
     cv::Mat result(3, size, CV_32F);
-    for (uint i = 0; i < hog_feat.size(); ++i)
+    for (int i = 0; i < num_feats; ++i)
         hog_feat[i].copyTo(cv::Mat(size[1], size[2], CV_32FC1, result.ptr(i)));
 
     return result;
@@ -889,6 +1545,11 @@ cv::Mat KCF_Tracker::get_subwindow(const cv::Mat &input, int cx, int cy, int wid
     if (x2 - x1 == 0 || y2 - y1 == 0)
         patch = cv::Mat::zeros(height, width, CV_32FC1);
     else {
+        {
+            std::lock_guard<std::mutex> lock(p_read_mutex);
+            cv::Rect read(x1, y1, x2 - x1, y2 - y1);
+            p_read_region = p_read_region.area() > 0 ? p_read_region | read : read;
+        }
         cv::copyMakeBorder(input(cv::Range(y1, y2), cv::Range(x1, x2)), patch, top, bottom, left, right,
                            cv::BORDER_REPLICATE);
         //      imshow( "copyMakeBorder", patch);
@@ -913,14 +1574,15 @@ void KCF_Tracker::GaussianCorrelation::operator()(cv::UMat &result, cv::UMat &xf
     TRACE("");
     DEBUG_PRINTM(xf);
     
-    xf_sqr_norm = (cv::norm(xf , cv::NORM_L2SQR) / static_cast<double>(xf.rows * xf.cols));
+    // Spectra are Hermitian halves - normalize by the spatial size
+    xf_sqr_norm = MatUtil::sqr_norm_hermitian(xf, size.width) / static_cast<double>(size.area());
     DEBUG_PRINT(xf_sqr_norm);
     
     if (auto_correlation) {
         yf_sqr_norm = xf_sqr_norm;
     } else {
         DEBUG_PRINTM(yf);
-        yf_sqr_norm = (cv::norm(yf , cv::NORM_L2SQR) / static_cast<double>(yf.rows * yf.cols));
+        yf_sqr_norm = MatUtil::sqr_norm_hermitian(yf, size.width) / static_cast<double>(size.area());
     }
     DEBUG_PRINT(yf_sqr_norm);
     
@@ -931,10 +1593,19 @@ void KCF_Tracker::GaussianCorrelation::operator()(cv::UMat &result, cv::UMat &xf
     // ifft2 and sum over 3rd dimension, we dont care about individual channels
     cv::UMat xyf_sum = MatUtil::sum_over_channels(xyf);
     DEBUG_PRINTM(xyf_sum);    
-    kcf.fft.inverse(xyf_sum, ifft_res);
-    DEBUG_PRINTM(ifft_res);
 
-    float numel_xf_inv = 1.f / (xf.cols * xf.rows * (xf.channels() / 2));
+    float numel_xf_inv = 1.f / (size.area() * (xf.channels() / 2));
+
+    if (kcf.p_kernel == KCF_Config::Kernel::LINEAR) {
+        // Linear kernel needs no transformation back to spatial domain
+        xyf_sum.convertTo(result, CV_32FC2, numel_xf_inv);
+        DEBUG_PRINTM(result);
+        return;
+    }
+
+    // FFT normalization is folded into the factor below
+    kcf.fft->inverse(xyf_sum, ifft_res, false);
+    DEBUG_PRINTM(ifft_res);
     
     cv::Mat ifft_res_Temp = ifft_res.getMat(cv::ACCESS_RW);    
     cv::Mat plane = MatUtil::plane(0,ifft_res_Temp);
@@ -942,7 +1613,7 @@ void KCF_Tracker::GaussianCorrelation::operator()(cv::UMat &result, cv::UMat &xf
     
     cv::Mat matExpr;
     cv::GMat in;
-    cv::GMat inTemp = cv::gapi::mulC(in, -2);
+    cv::GMat inTemp = cv::gapi::mulC(in, -2. / size.area());
     cv::GMat inTemp2 = cv::gapi::addC(inTemp, xf_sqr_norm + yf_sqr_norm);
     cv::GMat out = cv::gapi::mulC(inTemp2, numel_xf_inv);
     cv::GComputation getMaxArg(in, out);
@@ -952,80 +1623,17 @@ void KCF_Tracker::GaussianCorrelation::operator()(cv::UMat &result, cv::UMat &xf
     
     DEBUG_PRINTM(plane);
 
-    kcf.fft.forward(MatUtil::plane(0,ifft_res), result);
-}
-
-float get_response_circular(cv::Point2i &pt, cv::Mat &response)
-{
-    int x = pt.x;
-    int y = pt.y;
-    assert(response.dims == 2); // ensure .cols and .rows are valid
-    if (x < 0) x = response.cols + x;
-    if (y < 0) y = response.rows + y;
-    if (x >= response.cols) x = x - response.cols;
-    if (y >= response.rows) y = y - response.rows;
-
-    return response.at<float>(y, x);
-}
-
-cv::Point2f KCF_Tracker::sub_pixel_peak(cv::Point &max_loc, cv::Mat &response) const
-{
-    // find neighbourhood of max_loc (response is circular)
-    // 1 2 3
-    // 4   5
-    // 6 7 8
-    cv::Point2i p1(max_loc.x - 1, max_loc.y - 1), p2(max_loc.x, max_loc.y - 1), p3(max_loc.x + 1, max_loc.y - 1);
-    cv::Point2i p4(max_loc.x - 1, max_loc.y), p5(max_loc.x + 1, max_loc.y);
-    cv::Point2i p6(max_loc.x - 1, max_loc.y + 1), p7(max_loc.x, max_loc.y + 1), p8(max_loc.x + 1, max_loc.y + 1);
-
-    // clang-format off
-    // fit 2d quadratic function f(x, y) = a*x^2 + b*x*y + c*y^2 + d*x + e*y + f
-    cv::Mat A = (cv::Mat_<float>(9, 6) <<
-                 p1.x*p1.x, p1.x*p1.y, p1.y*p1.y, p1.x, p1.y, 1.f,
-                 p2.x*p2.x, p2.x*p2.y, p2.y*p2.y, p2.x, p2.y, 1.f,
-                 p3.x*p3.x, p3.x*p3.y, p3.y*p3.y, p3.x, p3.y, 1.f,
-                 p4.x*p4.x, p4.x*p4.y, p4.y*p4.y, p4.x, p4.y, 1.f,
-                 p5.x*p5.x, p5.x*p5.y, p5.y*p5.y, p5.x, p5.y, 1.f,
-                 p6.x*p6.x, p6.x*p6.y, p6.y*p6.y, p6.x, p6.y, 1.f,
-                 p7.x*p7.x, p7.x*p7.y, p7.y*p7.y, p7.x, p7.y, 1.f,
-                 p8.x*p8.x, p8.x*p8.y, p8.y*p8.y, p8.x, p8.y, 1.f,
-                 max_loc.x*max_loc.x, max_loc.x*max_loc.y, max_loc.y*max_loc.y, max_loc.x, max_loc.y, 1.f);
-    cv::Mat fval = (cv::Mat_<float>(9, 1) <<
-                    get_response_circular(p1, response),
-                    get_response_circular(p2, response),
-                    get_response_circular(p3, response),
-                    get_response_circular(p4, response),
-                    get_response_circular(p5, response),
-                    get_response_circular(p6, response),
-                    get_response_circular(p7, response),
-                    get_response_circular(p8, response),
-                    get_response_circular(max_loc, response));
-    // clang-format on
-    cv::Mat x;
-    cv::solve(A, fval, x, cv::DECOMP_SVD);
-
-    float a = x.at<float>(0), b = x.at<float>(1), c = x.at<float>(2), d = x.at<float>(3), e = x.at<float>(4);
-
-    cv::Point2f sub_peak(max_loc.x, max_loc.y);
-    if (4 * a * c - b * b > p_floating_error) {
-        sub_peak.y = ((2.f * a * e) / b - d) / (b - (4 * a * c) / b);
-        sub_peak.x = (-2 * c * sub_peak.y - e) / b;
-        if (fabs(sub_peak.x - max_loc.x) > 1 ||
-            fabs(sub_peak.y - max_loc.y) > 1)
-            sub_peak = max_loc;
-    }
-
-    return sub_peak;
+    kcf.fft->forward(MatUtil::plane(0,ifft_res), result);
 }
 
 double KCF_Tracker::sub_grid_scale(uint max_index)
 {
     cv::Mat A, fval;
-    const auto &vec = d->IF_BIG_BATCH(threadctxs[0].max, threadctxs);
-    uint index = vec.getScaleIdx(max_index);
-    uint angle_idx = vec.getAngleIdx(max_index);
+    auto &grid = d->contexts;
+    uint index = grid.getScaleIdx(max_index);
+    uint angle_idx = grid.getAngleIdx(max_index);
 
-    if (index >= vec.size()) {
+    if (index >= grid.size()) {
         // interpolate from all values
         // fit 1d quadratic function f(x) = a*x^2 + b*x + c
         A.create(p_scales.size(), 3, CV_32FC1);
@@ -1034,28 +1642,23 @@ double KCF_Tracker::sub_grid_scale(uint max_index)
             A.at<float>(i, 0) = float(p_scales[i] * p_scales[i]);
             A.at<float>(i, 1) = float(p_scales[i]);
             A.at<float>(i, 2) = 1;
-            fval.at<float>(i) = d->IF_BIG_BATCH(threadctxs[0].max[i].response, threadctxs(i, angle_idx).max.response);
+            fval.at<float>(i) = grid(i, angle_idx).max().response;
         }
     } else {
         // only from neighbours
         if (index == 0 || index == p_scales.size() - 1)
            return p_scales[index];
+        if (!grid(index - 1, angle_idx).max().valid || !grid(index + 1, angle_idx).max().valid)
+           return p_scales[index]; // neighbours were not evaluated in this frame
 
         A = (cv::Mat_<float>(3, 3) <<
              p_scales[index - 1] * p_scales[index - 1], p_scales[index - 1], 1,
              p_scales[index + 0] * p_scales[index + 0], p_scales[index + 0], 1,
              p_scales[index + 1] * p_scales[index + 1], p_scales[index + 1], 1);
-#ifdef BIG_BATCH
         fval = (cv::Mat_<float>(3, 1) <<
-                d->threadctxs[0].max(index - 1, angle_idx).response,
-                d->threadctxs[0].max(index + 0, angle_idx).response,
-                d->threadctxs[0].max(index + 1, angle_idx).response);
-#else
-        fval = (cv::Mat_<float>(3, 1) <<
-                d->threadctxs(index - 1, angle_idx).max.response,
-                d->threadctxs(index + 0, angle_idx).max.response,
-                d->threadctxs(index + 1, angle_idx).max.response);
-#endif
+                grid(index - 1, angle_idx).max().response,
+                grid(index + 0, angle_idx).max().response,
+                grid(index + 1, angle_idx).max().response);
     }
 
     cv::Mat x;
@@ -1070,11 +1673,11 @@ double KCF_Tracker::sub_grid_scale(uint max_index)
 double KCF_Tracker::sub_grid_angle(uint max_index)
 {
     cv::Mat A, fval;
-    const auto &vec = d->IF_BIG_BATCH(threadctxs[0].max, threadctxs);
-    uint scale_idx = vec.getScaleIdx(max_index);
-    uint index = vec.getAngleIdx(max_index);
+    auto &grid = d->contexts;
+    uint scale_idx = grid.getScaleIdx(max_index);
+    uint index = grid.getAngleIdx(max_index);
 
-    if (index >= vec.size()) {
+    if (index >= grid.size()) {
         // interpolate from all values
         // fit 1d quadratic function f(x) = a*x^2 + b*x + c
         A.create(p_angles.size(), 3, CV_32FC1);
@@ -1083,28 +1686,23 @@ double KCF_Tracker::sub_grid_angle(uint max_index)
             A.at<float>(i, 0) = float(p_angles[i] * p_angles[i]);
             A.at<float>(i, 1) = float(p_angles[i]);
             A.at<float>(i, 2) = 1;
-            fval.at<float>(i) = d->IF_BIG_BATCH(threadctxs[0].max[i].response, threadctxs(scale_idx, i).max.response);
+            fval.at<float>(i) = grid(scale_idx, i).max().response;
         }
     } else {
         // only from neighbours
         if (index == 0 || index == p_angles.size() - 1)
            return p_angles[index];
+        if (!grid(scale_idx, index - 1).max().valid || !grid(scale_idx, index + 1).max().valid)
+           return p_angles[index]; // neighbours were not evaluated in this frame
 
         A = (cv::Mat_<float>(3, 3) <<
              p_angles[index - 1] * p_angles[index - 1], p_angles[index - 1], 1,
              p_angles[index + 0] * p_angles[index + 0], p_angles[index + 0], 1,
              p_angles[index + 1] * p_angles[index + 1], p_angles[index + 1], 1);
-#ifdef BIG_BATCH
         fval = (cv::Mat_<float>(3, 1) <<
-                d->threadctxs[0].max(scale_idx, index - 1).response,
-                d->threadctxs[0].max(scale_idx, index + 0).response,
-                d->threadctxs[0].max(scale_idx, index + 1).response);
-#else
-        fval = (cv::Mat_<float>(3, 1) <<
-                d->threadctxs(scale_idx, index - 1).max.response,
-                d->threadctxs(scale_idx, index + 0).max.response,
-                d->threadctxs(scale_idx, index + 1).max.response);
-#endif
+                grid(scale_idx, index - 1).max().response,
+                grid(scale_idx, index + 0).max().response,
+                grid(scale_idx, index + 1).max().response);
     }
 
     cv::Mat x;
@@ -4,6 +4,7 @@
 #include <opencv2/opencv.hpp>
 #include <vector>
 #include <memory>
+#include <mutex>
 #include "fhog.hpp"
 #include "debug.h"
 
@@ -13,6 +14,10 @@
 #endif
 
 #include "cnfeat.hpp"
+#include "kcf_config.h"
+#include "governor.h"
+#include "motion.h"
+#include "fft_fixed.h"
 #ifdef FFTW
 #include "fft_fftw.h"
 #define FFT Fftw
@@ -49,6 +54,41 @@ struct BBox_c
 
 };
 
+// Statistics about processing of the last frame
+struct KCF_FrameStats {
+    // Stage durations in milliseconds
+    double t_preprocess = 0; // color conversion and resizing
+    double t_detect = 0;     // evaluation of scale/angle contexts
+    double t_localize = 0;   // peak and sub-grid localization
+    double t_train = 0;      // model update
+    double latency = 0;      // whole frame
+
+    unsigned contexts_evaluated = 0;
+    bool early_exit = false; // only the centre context was evaluated
+    double psr = 0;          // peak-to-sidelobe ratio of the winning response
+    bool trained = false;
+    bool reused_features = false; // training sample taken from the winning detection
+    enum class TrainSkip { NONE, INTERVAL, LOW_CONFIDENCE, REDUNDANT } train_skip = TrainSkip::NONE;
+};
+
+// Cumulative statistics of a tracker since its construction
+struct KCF_TrackerStats {
+    uint64_t frames = 0;             // calls of track()
+    uint64_t inits = 0;              // calls of init(), re-initializations included
+    uint64_t contexts_evaluated = 0;
+    uint64_t early_exits = 0;
+    uint64_t trainings = 0;
+    uint64_t trainings_skipped = 0;
+    uint64_t reused_features = 0;
+
+    // Total stage durations in milliseconds (see KCF_FrameStats)
+    double t_preprocess = 0;
+    double t_detect = 0;
+    double t_localize = 0;
+    double t_train = 0;
+    double latency = 0;
+};
+
 class KCF_Tracker
 {
     friend ThreadCtx;
@@ -56,13 +96,7 @@ class KCF_Tracker
 public:
     bool m_debug {false};
     enum class vd {NONE, PATCH, RESPONSE} m_visual_debug {vd::NONE};
-    constexpr static bool m_use_scale {true};
-    constexpr static bool m_use_color {true};
-    constexpr static bool m_use_subpixel_localization {true};
-    constexpr static bool m_use_subgrid_scale {true};
-    constexpr static bool m_use_subgrid_angle {true};
-    constexpr static bool m_use_cnfeat {true};
-    constexpr static bool m_use_linearkernel {false};
+    KCF_Config m_config;                  // see kcf_config.h for what is latched by init()
     const int p_cell_size = 4;            //4 for hog (= bin_size)
 
     /*
@@ -86,9 +120,23 @@ public:
     void track(cv::UMat & img);
     BBox_c getBBox();
     double getFilterResponse() const; // Measure of tracking accuracy
+    double getPSR() const { return max_psr; } // Peak-to-sidelobe ratio of the filter response
+    const KCF_FrameStats &getFrameStats() const { return p_frame_stats; }
+    // Totals over all frames; the process-wide totals of all trackers are
+    // available from MetricsRegistry::global() (see metrics.h)
+    const KCF_TrackerStats &stats() const { return p_stats; }
+    // Part of the input image read by the last init() or track(), used to
+    // record the inputs for replay (see recording.hpp)
+    cv::Rect getReadRegion() const;
+    // Parallelism policy chosen by init() (see m_config.parallel)
+    KCF_Config::Parallel getParallelPolicy() const { return p_parallel; }
+    // Decision taken by the latency governor for the last frame (see m_config.target_latency)
+    const LatencyGovernor::Decision &getGovernorDecision() const { return p_governor.decision(); }
 
 private:
-    FFT &fft;
+    std::unique_ptr<Fft> fft;             // FFT backend selected by init()
+    FftOptions p_fft_options;             // options fft was initialized with
+    KCF_Config::Parallel p_parallel = KCF_Config::Parallel::NONE; // resolved m_config.parallel
 
     // Initial pose of tracked object in internal image coordinates
     // (scaled by p_downscale_factor if p_resize_image)
@@ -100,33 +148,64 @@ private:
     double p_current_angle = 0.;
 
     double max_response = -1.;
+    double max_psr = 0.;
+
+    KCF_FrameStats p_frame_stats;
+    KCF_TrackerStats p_stats;
+    // Union of the source regions of get_subwindow() in the (possibly
+    // downscaled) input of the current frame
+    mutable std::mutex p_read_mutex;
+    mutable cv::Rect p_read_region;
+    cv::Size p_input_size;
+    void reset_read_region(const cv::UMat &img);
+    void record_stats();
+    LatencyGovernor p_governor;
+    uint p_frames_since_train = 0;
+    MotionModel p_motion;
 
     bool p_resize_image = false;
 
     constexpr static double p_downscale_factor = 0.5;
     constexpr static double p_floating_error = 0.0001;
 
-    const double p_padding = 1.5;
+    double p_padding = 1.5;
     const double p_output_sigma_factor = 0.1;
-    double p_output_sigma;
+    double p_output_sigma = 0.;
     const double p_kernel_sigma = 0.5;    //def = 0.5
     const double p_lambda = 1e-4;         //regularization in learning step
     const double p_interp_factor = 0.02;  //def = 0.02, linear interpolation factor for adaptation
     cv::Size p_windows_size;              // size of the patch to find the tracked object in
     cv::Size fit_size;                    // size to which rescale the patch for better FFT performance
 
-    constexpr static uint p_num_scales = m_use_scale ? 5 : 1;
-    constexpr static double p_scale_step = 1.03;
+    // Search grid and feature set latched from m_config by init()
+    uint p_num_scales;
+    double p_scale_step;
     double p_min_max_scale[2];
     std::vector<double> p_scales;
 
-    constexpr static uint p_num_angles = 3;
-    constexpr static int p_angle_step = 10;
+    uint p_num_angles;
+    int p_angle_step;
     std::vector<double> p_angles;
 
-    constexpr static int p_num_of_feats = 31 + (m_use_color ? 3 : 0) + (m_use_cnfeat ? 10 : 0);
+    KCF_Config::Kernel p_kernel;
+    int p_num_of_feats = 0;
     cv::Size feature_size;
 
+    // Feature pipelines specialized at compile time. init() selects one
+    // of them according to m_config and the number of image channels.
+    template <bool RGB, bool CN>
+    struct FeatureSet {
+        static constexpr int num_feats = 31 + (RGB ? 3 : 0) + (CN ? 10 : 0);
+    };
+    typedef cv::Mat (KCF_Tracker::*get_features_fn)(cv::Mat &input_rgb, cv::Mat &input_gray, cv::Mat *dbg_patch,
+                                                    int cx, int cy, int size_x, int size_y,
+                                                    double scale, double angle) const;
+    get_features_fn p_get_features = nullptr;
+    template <bool RGB, bool CN> void use_pipeline();
+    template <bool RGB, bool CN>
+    cv::Mat get_features_impl(cv::Mat &input_rgb, cv::Mat &input_gray, cv::Mat *dbg_patch,
+                              int cx, int cy, int size_x, int size_y, double scale, double angle) const;
+
     std::unique_ptr<Kcf_Tracker_Private> d;
 
     class Model {
@@ -164,6 +243,7 @@ private:
     class GaussianCorrelation {
       public:
         GaussianCorrelation(uint num_scales, uint num_feats, cv::Size size)
+            : size(size)
         {
                 cv::Size temp = Fft::freq_size(size);
                 xyf = cv::UMat(3, std::vector<int>({(int) num_scales, temp.height, temp.width}).data(), CV_32FC(num_feats*2));
@@ -173,6 +253,7 @@ private:
         void operator()(cv::UMat &result, cv::UMat &xf, cv::UMat &yf, double sigma, bool auto_correlation, const KCF_Tracker &kcf);
 
       private:
+        cv::Size size; // spatial size
         double xf_sqr_norm;
         double yf_sqr_norm;
         cv::UMat xyf;
@@ -189,13 +270,24 @@ private:
     cv::Mat circshift(const cv::Mat &patch, int x_rot, int y_rot) const;
     cv::UMat circshift(const cv::UMat &patch, int x_rot, int y_rot) const;
     cv::Mat cosine_window_function(int dim1, int dim2);
-    cv::Mat get_features(cv::Mat &input_rgb, cv::Mat &input_gray, cv::Mat *dbg_patch, int cx, int cy, int size_x, int size_y, double scale, double angle) const;
-    cv::Point2f sub_pixel_peak(cv::Point &max_loc, cv::Mat &response) const;
+    cv::Mat get_features(cv::Mat &input_rgb, cv::Mat &input_gray, cv::Mat *dbg_patch, int cx, int cy, int size_x, int size_y, double scale, double angle) const
+    {
+        return (this->*p_get_features)(input_rgb, input_gray, dbg_patch, cx, cy, size_x, size_y, scale, angle);
+    }
     double sub_grid_scale(uint index);
     void resizeImgs(cv::UMat &input_rgb, cv::UMat &input_gray);
     void train(cv::UMat input_rgb, cv::UMat input_gray, double interp_factor);
+    void train_spectrum(cv::UMat &zf, cv::Point2d shift, double interp_factor);
+    void update_model(double interp_factor);
+    uint track_contexts(const std::vector<uint> &ctx_idx, cv::UMat &input_rgb, cv::UMat &input_gray);
+    // Returns the number of evaluated contexts; rounds is set to the number
+    // of evaluation rounds (see LatencyGovernor::rounds())
+    uint search_contexts(const LatencyGovernor::Decision &effort, cv::UMat &input_rgb, cv::UMat &input_gray,
+                         uint &rounds);
     double findMaxReponse(uint &max_idx, cv::Point2d &new_location) const;
     double sub_grid_angle(uint max_index);
+    bool use_fixed_fft(cv::Size size, unsigned channels) const;
+    cv::Size smooth_feature_size(cv::Size window, double tolerance) const;
 };
 
 #endif //KCF_HEADER_6565467831231
@@ -0,0 +1,208 @@
+#include "kcf_c.h"
+#include "kcf.h"
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+struct kcf_tracker {
+    KCF_Tracker tracker;
+    bool initialized = false; // the last kcf_init() succeeded
+};
+
+static thread_local std::string last_error;
+
+// Returns a header over the caller's pixels, or converts them to BGR in
+// 'buffer' for formats the tracker does not take directly
+static cv::Mat frame_to_mat(const kcf_frame *frame, cv::Mat &buffer)
+{
+    if (!frame || !frame->data || frame->width <= 0 || frame->height <= 0)
+        throw std::runtime_error("Invalid frame");
+
+    int type;
+    switch (frame->format) {
+    case KCF_PIXEL_BGR8:
+    case KCF_PIXEL_RGB8:
+        type = CV_8UC3;
+        break;
+    case KCF_PIXEL_GRAY8:
+        type = CV_8UC1;
+        break;
+    case KCF_PIXEL_BGRA8:
+        type = CV_8UC4;
+        break;
+    default:
+        throw std::runtime_error("Unknown pixel format " + std::to_string(frame->format));
+    }
+    if (frame->stride < int64_t(frame->width) * CV_ELEM_SIZE(type))
+        throw std::runtime_error("Frame stride smaller than its width");
+
+    cv::Mat mat(frame->height, frame->width, type, const_cast<void *>(frame->data), size_t(frame->stride));
+    switch (frame->format) {
+    case KCF_PIXEL_RGB8:
+        cv::cvtColor(mat, buffer, cv::COLOR_RGB2BGR);
+        return buffer;
+    case KCF_PIXEL_BGRA8:
+        cv::cvtColor(mat, buffer, cv::COLOR_BGRA2BGR);
+        return buffer;
+    default:
+        return mat;
+    }
+}
+
+static void get_result(KCF_Tracker &tracker, kcf_result *result)
+{
+    BBox_c bb = tracker.getBBox();
+    result->cx = float(bb.cx);
+    result->cy = float(bb.cy);
+    result->w = float(bb.w);
+    result->h = float(bb.h);
+    result->angle = float(bb.a);
+    result->response = float(tracker.getFilterResponse());
+    result->psr = float(tracker.getPSR());
+    result->status = 0;
+}
+
+static KCF_Tracker &get_tracker(kcf_tracker *tracker)
+{
+    if (!tracker)
+        throw std::runtime_error("NULL tracker");
+    return tracker->tracker;
+}
+
+// KCF_Tracker::track() needs the state built by a complete init()
+static KCF_Tracker &get_initialized(kcf_tracker *tracker)
+{
+    KCF_Tracker &t = get_tracker(tracker);
+    if (!tracker->initialized)
+        throw std::runtime_error("Tracker not initialized");
+    return t;
+}
+
+// Runs f, converting exceptions to the -1 return value. No exception may
+// cross the C interface.
+template <typename F>
+static int guarded(F f)
+{
+    try {
+        f();
+        return 0;
+    } catch (std::exception &e) {
+        last_error = e.what();
+        return -1;
+    } catch (...) {
+        last_error = "Unknown error";
+        return -1;
+    }
+}
+
+int kcf_api_version(void)
+{
+    return KCF_C_API_VERSION;
+}
+
+const char *kcf_last_error(void)
+{
+    return last_error.c_str();
+}
+
+kcf_tracker *kcf_create(const char *config)
+{
+    kcf_tracker *t = nullptr;
+    guarded([&]() {
+        std::unique_ptr<kcf_tracker> tracker(new kcf_tracker());
+        tracker->tracker.m_config.parallel = KCF_Config::Parallel::NONE;
+        if (config)
+            tracker->tracker.m_config.parse(config);
+        t = tracker.release();
+    });
+    return t;
+}
+
+void kcf_destroy(kcf_tracker *tracker)
+{
+    delete tracker;
+}
+
+int kcf_init(kcf_tracker *tracker, const kcf_frame *frame, int x, int y, int width, int height)
+{
+    return guarded([&]() {
+        cv::Mat buffer;
+        KCF_Tracker &t = get_tracker(tracker);
+        tracker->initialized = false;
+        cv::UMat img = frame_to_mat(frame, buffer).getUMat(cv::ACCESS_READ);
+        t.init(img, cv::Rect(x, y, width, height));
+        tracker->initialized = true;
+    });
+}
+
+int kcf_track(kcf_tracker *tracker, const kcf_frame *frame, kcf_result *result)
+{
+    return guarded([&]() {
+        cv::Mat buffer;
+        KCF_Tracker &t = get_initialized(tracker);
+        cv::UMat img = frame_to_mat(frame, buffer).getUMat(cv::ACCESS_READ);
+        t.track(img);
+        if (result)
+            get_result(t, result);
+    });
+}
+
+int kcf_get_result(kcf_tracker *tracker, kcf_result *result)
+{
+    return guarded([&]() {
+        if (!result)
+            throw std::runtime_error("NULL result");
+        get_result(get_initialized(tracker), result);
+    });
+}
+
+double kcf_last_latency_ms(kcf_tracker *tracker)
+{
+    double latency = -1;
+    guarded([&]() { latency = get_tracker(tracker).getFrameStats().latency; });
+    return latency;
+}
+
+int kcf_track_many(const kcf_frame *frame, kcf_tracker *const *trackers, int n, kcf_result *results)
+{
+    cv::Mat buffer, mat;
+    if (guarded([&]() {
+            if (n < 0 || (n > 0 && (!trackers || !results)))
+                throw std::runtime_error("Invalid tracker array");
+            // Each tracker may be used by one thread only
+            std::set<kcf_tracker *> unique;
+            for (int i = 0; i < n; ++i) {
+                get_initialized(trackers[i]);
+                if (!unique.insert(trackers[i]).second)
+                    throw std::runtime_error("Tracker " + std::to_string(i) + " listed twice");
+            }
+            mat = frame_to_mat(frame, buffer);
+        }) != 0)
+        return -1;
+
+    // Objects are independent, so they are tracked on OpenCV's thread pool
+    std::vector<std::string> errors(n);
+    cv::parallel_for_(cv::Range(0, n), [&](const cv::Range &range) {
+        for (int i = range.start; i < range.end; ++i) {
+            try {
+                cv::UMat img = mat.getUMat(cv::ACCESS_READ);
+                trackers[i]->tracker.track(img);
+                get_result(trackers[i]->tracker, &results[i]);
+            } catch (std::exception &e) {
+                results[i] = kcf_result{0, 0, 0, 0, 0, 0, 0, -1};
+                errors[i] = e.what();
+            } catch (...) {
+                results[i] = kcf_result{0, 0, 0, 0, 0, 0, 0, -1};
+                errors[i] = "Unknown error";
+            }
+        }
+    });
+
+    for (int i = 0; i < n; ++i)
+        if (results[i].status != 0) {
+            last_error = "Object " + std::to_string(i) + ": " + errors[i];
+            return -1;
+        }
+    return 0;
+}
@@ -0,0 +1,93 @@
+#ifndef KCF_C_H
+#define KCF_C_H
+
+/*
+ * C interface of the tracker (libkcf_c.so) for use from other languages.
+ * Trackers are referred to by opaque handles. Frames are passed as raw
+ * pixel buffers described by kcf_frame and are not copied when their
+ * format is KCF_PIXEL_BGR8 or KCF_PIXEL_GRAY8.
+ *
+ * Functions returning int return 0 on success and -1 on error; the
+ * error message is then available from kcf_last_error() in the calling
+ * thread. A tracker must not be used by multiple threads at once.
+ */
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define KCF_C_API_VERSION 1
+
+#if defined(__GNUC__)
+#define KCF_C_EXPORT __attribute__((visibility("default")))
+#else
+#define KCF_C_EXPORT
+#endif
+
+typedef struct kcf_tracker kcf_tracker;
+
+typedef enum {
+    KCF_PIXEL_BGR8 = 0,
+    KCF_PIXEL_RGB8 = 1,
+    KCF_PIXEL_GRAY8 = 2,
+    KCF_PIXEL_BGRA8 = 3,
+} kcf_pixel_format;
+
+typedef struct {
+    const void *data; /* first pixel of the top row */
+    int32_t width, height;
+    int64_t stride;   /* bytes between the starts of consecutive rows */
+    int32_t format;   /* kcf_pixel_format */
+} kcf_frame;
+
+typedef struct {
+    float cx, cy, w, h; /* centre and size of the bounding box */
+    float angle;        /* degrees */
+    float response;     /* peak of the filter response */
+    float psr;          /* peak-to-sidelobe ratio of the response */
+    int32_t status;     /* 0 on success, -1 if tracking failed */
+} kcf_result;
+
+/* Returns KCF_C_API_VERSION of the library */
+KCF_C_EXPORT int kcf_api_version(void);
+
+/* Message describing the last error in the calling thread */
+KCF_C_EXPORT const char *kcf_last_error(void);
+
+/*
+ * Creates a tracker configured by "key=value,..." options (see
+ * KCF_Config, may be NULL). As trackers are meant to run in parallel by
+ * kcf_track_many(), 'parallel' defaults to 'none'. Returns NULL on error.
+ */
+KCF_C_EXPORT kcf_tracker *kcf_create(const char *config);
+KCF_C_EXPORT void kcf_destroy(kcf_tracker *tracker);
+
+/*
+ * (Re)initializes the tracker with the object at x, y, width, height.
+ * Until it succeeds, tracking and getting results of the tracker fail.
+ */
+KCF_C_EXPORT int kcf_init(kcf_tracker *tracker, const kcf_frame *frame, int x, int y, int width, int height);
+
+/* Tracks the object in the next frame; result may be NULL */
+KCF_C_EXPORT int kcf_track(kcf_tracker *tracker, const kcf_frame *frame, kcf_result *result);
+
+/* Returns the current position of the object */
+KCF_C_EXPORT int kcf_get_result(kcf_tracker *tracker, kcf_result *result);
+
+/* Duration of the last kcf_track() inside the tracker in milliseconds, -1 on error */
+KCF_C_EXPORT double kcf_last_latency_ms(kcf_tracker *tracker);
+
+/*
+ * Tracks n objects in the same frame in parallel. results[i] receives
+ * the result of trackers[i]. Returns -1 if tracking of any object failed,
+ * see results[i].status. A tracker must not be listed more than once.
+ */
+KCF_C_EXPORT int kcf_track_many(const kcf_frame *frame, kcf_tracker *const *trackers, int n, kcf_result *results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* KCF_C_H */
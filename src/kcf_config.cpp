@@ -0,0 +1,179 @@
+#include "kcf_config.h"
+#include <climits>
+#include <cmath>
+#include <stdexcept>
+#include <sstream>
+
+static bool parse_bool(const std::string &key, const std::string &value)
+{
+    if (value == "1" || value == "true" || value == "on" || value == "yes")
+        return true;
+    if (value == "0" || value == "false" || value == "off" || value == "no")
+        return false;
+    throw std::runtime_error("Invalid boolean value for '" + key + "': " + value);
+}
+
+static double parse_double(const std::string &key, const std::string &value)
+{
+    size_t pos = 0;
+    double ret;
+    try {
+        ret = std::stod(value, &pos);
+    } catch (std::logic_error &) {
+        pos = 0;
+    }
+    if (pos == 0 || pos != value.size() || !std::isfinite(ret))
+        throw std::runtime_error("Invalid numeric value for '" + key + "': " + value);
+    return ret;
+}
+
+static unsigned parse_uint(const std::string &key, const std::string &value)
+{
+    double v = parse_double(key, value);
+    // Range check before the conversion, which is undefined for values out of range
+    if (v < 0 || v > UINT_MAX || v != std::floor(v))
+        throw std::runtime_error("Invalid unsigned value for '" + key + "': " + value);
+    return unsigned(v);
+}
+
+void KCF_Config::set(const std::string &key, const std::string &value)
+{
+    if (key == "padding") {
+        padding = parse_double(key, value);
+        if (padding < 0)
+            throw std::runtime_error("Padding must not be negative");
+    } else if (key == "scales") {
+        num_scales = parse_uint(key, value);
+        if (num_scales == 0)
+            throw std::runtime_error("Number of scales must be positive");
+    } else if (key == "scale_step") {
+        scale_step = parse_double(key, value);
+        // The scale limits are powers of scale_step, see KCF_Tracker::init()
+        if (scale_step <= 1)
+            throw std::runtime_error("Scale step must be greater than 1");
+    } else if (key == "angles") {
+        num_angles = parse_uint(key, value);
+        if (num_angles == 0)
+            throw std::runtime_error("Number of angles must be positive");
+    } else if (key == "angle_step") {
+        double step = parse_double(key, value);
+        if (step < INT_MIN || step > INT_MAX)
+            throw std::runtime_error("Invalid angle step: " + value);
+        angle_step = int(step);
+    } else if (key == "color") {
+        color = parse_bool(key, value);
+    } else if (key == "cnfeat") {
+        cnfeat = parse_bool(key, value);
+    } else if (key == "kernel") {
+        if (value == "gaussian")
+            kernel = Kernel::GAUSSIAN;
+        else if (value == "linear")
+            kernel = Kernel::LINEAR;
+        else
+            throw std::runtime_error("Unknown kernel: " + value);
+    } else if (key == "fft") {
+        if (value == "auto")
+            fft = FftBackend::AUTO;
+        else if (value == "fixed")
+            fft = FftBackend::FIXED;
+        else if (value == "native")
+            fft = FftBackend::NATIVE;
+        else
+            throw std::runtime_error("Unknown FFT backend: " + value);
+    } else if (key == "fit_smooth") {
+        fit_smooth = parse_double(key, value);
+        if (fit_smooth < 0 || fit_smooth >= 1)
+            throw std::runtime_error("Smooth fit tolerance must be in range [0, 1)");
+    } else if (key == "fft_rigor") {
+        if (value == "estimate")
+            fft_options.rigor = FftOptions::Rigor::ESTIMATE;
+        else if (value == "measure")
+            fft_options.rigor = FftOptions::Rigor::MEASURE;
+        else if (value == "patient")
+            fft_options.rigor = FftOptions::Rigor::PATIENT;
+        else if (value == "exhaustive")
+            fft_options.rigor = FftOptions::Rigor::EXHAUSTIVE;
+        else
+            throw std::runtime_error("Unknown FFT planning rigor: " + value);
+    } else if (key == "fft_wisdom") {
+        fft_options.wisdom_file = value;
+    } else if (key == "parallel") {
+        if (value == "auto")
+            parallel = Parallel::AUTO;
+        else if (value == "none")
+            parallel = Parallel::NONE;
+        else if (value == "contexts")
+            parallel = Parallel::CONTEXTS;
+        else if (value == "fft")
+            parallel = Parallel::FFT;
+        else
+            throw std::runtime_error("Unknown parallelism policy: " + value);
+    } else if (key == "subpixel") {
+        subpixel_localization = parse_bool(key, value);
+    } else if (key == "subgrid_scale") {
+        subgrid_scale = parse_bool(key, value);
+    } else if (key == "subgrid_angle") {
+        subgrid_angle = parse_bool(key, value);
+    } else if (key == "search") {
+        if (value == "full")
+            search = Search::FULL;
+        else if (value == "local")
+            search = Search::LOCAL;
+        else
+            throw std::runtime_error("Unknown search mode: " + value);
+    } else if (key == "early_exit_psr") {
+        early_exit_psr = parse_double(key, value);
+    } else if (key == "early_exit_response") {
+        early_exit_response = parse_double(key, value);
+    } else if (key == "latency") {
+        target_latency = parse_double(key, value);
+    } else if (key == "train_min_psr") {
+        train_min_psr = parse_double(key, value);
+    } else if (key == "train_skip_response") {
+        train_skip_response = parse_double(key, value);
+    } else if (key == "train_max_skip") {
+        train_max_skip = parse_uint(key, value);
+    } else if (key == "alpha_update") {
+        if (value == "full")
+            alpha_update = AlphaUpdate::FULL;
+        else if (value == "incremental")
+            alpha_update = AlphaUpdate::INCREMENTAL;
+        else
+            throw std::runtime_error("Unknown alpha update mode: " + value);
+    } else if (key == "reuse_features") {
+        reuse_features = parse_bool(key, value);
+    } else if (key == "reuse_max_shift") {
+        reuse_max_shift = parse_double(key, value);
+    } else if (key == "reuse_max_scale") {
+        reuse_max_scale = parse_double(key, value);
+    } else if (key == "reuse_max_angle") {
+        reuse_max_angle = parse_double(key, value);
+    } else if (key == "motion") {
+        if (value == "none")
+            motion = Motion::NONE;
+        else if (value == "velocity")
+            motion = Motion::CONST_VELOCITY;
+        else if (value == "kalman")
+            motion = Motion::KALMAN;
+        else
+            throw std::runtime_error("Unknown motion model: " + value);
+    } else {
+        throw std::runtime_error("Unknown configuration option: " + key);
+    }
+}
+
+void KCF_Config::parse(const std::string &options)
+{
+    std::istringstream s(options);
+    std::string item;
+
+    while (std::getline(s, item, ',')) {
+        if (item.empty())
+            continue;
+        size_t eq = item.find('=');
+        if (eq == std::string::npos)
+            set(item, "1"); // bare key enables a boolean option
+        else
+            set(item.substr(0, eq), item.substr(eq + 1));
+    }
+}
@@ -0,0 +1,133 @@
+#ifndef KCF_CONFIG_H
+#define KCF_CONFIG_H
+
+#include <string>
+
+// Options of FFT backends that plan the transforms (FFTW)
+struct FftOptions {
+    enum class Rigor { ESTIMATE, MEASURE, PATIENT, EXHAUSTIVE };
+    Rigor rigor = Rigor::PATIENT;
+    // FFTW wisdom is imported from this file before planning and the
+    // new plans are exported to it. Empty disables the persistence.
+    std::string wisdom_file;
+    // Number of threads used by a single transform. Set by the tracker
+    // according to its parallelism policy.
+    unsigned threads = 1;
+    // Set for a backend used only to time a transform size: its plans are
+    // neither cached nor exported to the wisdom file and nothing is printed.
+    bool probe = false;
+
+    bool operator==(const FftOptions &o) const
+    {
+        return rigor == o.rigor && wisdom_file == o.wisdom_file && threads == o.threads && probe == o.probe;
+    }
+    bool operator!=(const FftOptions &o) const { return !(*this == o); }
+};
+
+/*
+ * Run-time configuration of KCF_Tracker.
+ *
+ * The structural part (search grid, feature set and kernel) is latched
+ * by KCF_Tracker::init(), which maps it onto one of the compile-time
+ * specialized pipelines. Changing it has effect after the next init().
+ * The remaining options are consulted on every frame.
+ */
+struct KCF_Config {
+    enum class Kernel { GAUSSIAN, LINEAR };
+    enum class Search { FULL, LOCAL };
+    enum class Motion { NONE, CONST_VELOCITY, KALMAN };
+    enum class AlphaUpdate { FULL, INCREMENTAL };
+    enum class FftBackend { AUTO, FIXED, NATIVE };
+    enum class Parallel { AUTO, NONE, CONTEXTS, FFT };
+
+    // extra area surrounding the target
+    double padding = 1.5;
+
+    // search grid
+    unsigned num_scales = 5;
+    double scale_step = 1.03;
+    unsigned num_angles = 3;
+    int angle_step = 10;
+
+    // feature set (HoG is always used)
+    bool color = true;
+    bool cnfeat = true;
+
+    Kernel kernel = Kernel::GAUSSIAN;
+
+    // FFT implementation: NATIVE is the backend selected at compile time,
+    // FIXED the fixed-size kernels for power-of-two sizes from 8 to 128.
+    // AUTO uses FIXED when the feature size allows it and the FIXED
+    // transforms were measured to be faster than the NATIVE ones.
+    FftBackend fft = FftBackend::AUTO;
+    FftOptions fft_options;
+
+    // When non-zero and no fit size is given to init(), the patch is
+    // resized to the FFT friendly (2^a 3^b 5^c) feature size that has
+    // the lowest measured transform time per element among those
+    // deviating from the window by at most this (relative) tolerance.
+    double fit_smooth = 0;
+
+    // Where to use multiple threads: scale/angle contexts in parallel
+    // (OpenMP or ASYNC builds) or threaded FFTs (FFTW). AUTO decides at
+    // init from the number of contexts, feature size and cores.
+    Parallel parallel = Parallel::AUTO;
+
+    bool subpixel_localization = true;
+    bool subgrid_scale = true;
+    bool subgrid_angle = true;
+
+    // FULL evaluates all scale/angle contexts, LOCAL starts at the best
+    // context of the previous frame and its neighbours and moves towards
+    // the higher response only when the peak is at the evaluated border.
+    Search search = Search::FULL;
+
+    // Early exit: evaluate the (scale=1, angle=0) context first and skip
+    // the others if its peak-to-sidelobe ratio or peak response reaches
+    // the threshold and the peak is well inside the window. Zero disables
+    // the respective criterion.
+    double early_exit_psr = 0;
+    double early_exit_response = 0;
+
+    // Per-frame latency target in milliseconds. When non-zero, the
+    // latency governor adapts search effort to meet the target.
+    double target_latency = 0;
+
+    // Motion model predicting the position, scale and angle of the target
+    // in the next frame. The search window is centred at the prediction.
+    Motion motion = Motion::NONE;
+
+    // Confidence-gated model update. Training is skipped when the
+    // peak-to-sidelobe ratio of the winning response is below
+    // train_min_psr (unreliable localization, e.g. occlusion) or when the
+    // peak response reaches train_skip_response (appearance has barely
+    // changed). Redundant frames are skipped at most train_max_skip times
+    // in a row. Zero thresholds disable the respective criterion.
+    double train_min_psr = 0;
+    double train_skip_response = 0;
+    unsigned train_max_skip = 10;
+
+    // FULL recomputes the kernel from the interpolated model on every
+    // update. INCREMENTAL keeps the numerator and denominator of alphaf
+    // as running averages of terms computed from the new sample only.
+    AlphaUpdate alpha_update = AlphaUpdate::FULL;
+
+    // Build the training sample from the spectrum of the winning
+    // detection window, shifted in the Fourier domain to the new target
+    // position, instead of extracting features again. Falls back to
+    // extraction when the peak is more than reuse_max_shift cells away or
+    // the scale (relative) or angle (degrees) differ by more than the
+    // limits.
+    bool reuse_features = false;
+    double reuse_max_shift = 1.;
+    double reuse_max_scale = 0.01;
+    double reuse_max_angle = 1.;
+
+    // Sets option 'key' from its textual representation. Throws
+    // std::runtime_error for unknown keys or unparsable values.
+    void set(const std::string &key, const std::string &value);
+    // Parses comma separated list of key=value pairs.
+    void parse(const std::string &options);
+};
+
+#endif // KCF_CONFIG_H
@@ -117,6 +117,20 @@ static cv::UMat sum_over_channels(cv::UMat &host)
 }
 
 
+/*
+ * Returns squared L2 norm of the full spectrum of real signal(s) of the given width,
+ * computed from its non-redundant half (width/2+1 columns). Columns that have
+ * a conjugate counterpart in the omitted half are counted twice.
+**/
+static double sqr_norm_hermitian(cv::UMat &host, int width){
+    assert(host.cols == width / 2 + 1);
+    double norm = 2. * cv::norm(host, cv::NORM_L2SQR);
+    norm -= cv::norm(host.colRange(0, 1), cv::NORM_L2SQR);
+    if (width % 2 == 0)
+        norm -= cv::norm(host.colRange(host.cols - 1, host.cols), cv::NORM_L2SQR);
+    return norm;
+}
+
 /*
  * Extracts two channels from input, and sets them as data of resulting new matrix.
  * Presumes format where two neighbouring channels of input make one complex value.
@@ -0,0 +1,194 @@
+#include "metrics.h"
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+Histogram::Histogram(std::vector<double> bounds)
+    : m_bounds(std::move(bounds)), m_buckets(new std::atomic<uint64_t>[m_bounds.size() + 1])
+{
+    for (size_t i = 0; i <= m_bounds.size(); ++i)
+        m_buckets[i].store(0);
+}
+
+void Histogram::observe(double value)
+{
+    size_t i = 0;
+    while (i < m_bounds.size() && value > m_bounds[i])
+        ++i;
+    m_buckets[i].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+    double sum = m_sum.load(std::memory_order_relaxed);
+    while (!m_sum.compare_exchange_weak(sum, sum + value, std::memory_order_relaxed))
+        ;
+}
+
+std::vector<double> Histogram::exponential(double start, double factor, unsigned count)
+{
+    std::vector<double> bounds;
+    for (unsigned i = 0; i < count; ++i, start *= factor)
+        bounds.push_back(start);
+    return bounds;
+}
+
+std::vector<double> Histogram::linear(double start, double width, unsigned count)
+{
+    std::vector<double> bounds;
+    for (unsigned i = 0; i < count; ++i)
+        bounds.push_back(start + i * width);
+    return bounds;
+}
+
+MetricsRegistry &MetricsRegistry::global()
+{
+    static MetricsRegistry registry;
+    return registry;
+}
+
+// Splits 'name{labels}' into the family name and the labels without braces
+static std::pair<std::string, std::string> split_name(const std::string &name)
+{
+    size_t brace = name.find('{');
+    if (brace == std::string::npos)
+        return {name, ""};
+    return {name.substr(0, brace), name.substr(brace + 1, name.size() - brace - 2)};
+}
+
+Counter &MetricsRegistry::counter(const std::string &name, const std::string &help)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto &c = m_counters[name];
+    if (!c) {
+        c.reset(new Counter());
+        m_families.insert({split_name(name).first, {help, false}});
+    }
+    return *c;
+}
+
+Histogram &MetricsRegistry::histogram(const std::string &name, const std::string &help,
+                                      const std::vector<double> &bounds)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto &h = m_histograms[name];
+    if (!h) {
+        h.reset(new Histogram(bounds));
+        m_families.insert({split_name(name).first, {help, true}});
+    }
+    return *h;
+}
+
+static std::string with_label(const std::string &labels, const std::string &extra)
+{
+    if (labels.empty() && extra.empty())
+        return "";
+    return "{" + labels + (labels.empty() || extra.empty() ? "" : ",") + extra + "}";
+}
+
+std::string MetricsRegistry::prometheus() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::ostringstream out;
+    out.precision(10);
+
+    for (const auto &f : m_families) {
+        const std::string &family = f.first;
+        out << "# HELP " << family << " " << f.second.help << "\n";
+        out << "# TYPE " << family << (f.second.histogram ? " histogram" : " counter") << "\n";
+
+        if (!f.second.histogram) {
+            for (const auto &c : m_counters)
+                if (split_name(c.first).first == family)
+                    out << c.first << " " << c.second->value() << "\n";
+            continue;
+        }
+        for (const auto &h : m_histograms) {
+            auto name = split_name(h.first);
+            if (name.first != family)
+                continue;
+            const Histogram &hist = *h.second;
+            uint64_t cumulative = 0;
+            for (size_t i = 0; i < hist.bounds().size(); ++i) {
+                cumulative += hist.bucket(i);
+                std::ostringstream le;
+                le.precision(6);
+                le << "le=\"" << hist.bounds()[i] << "\"";
+                out << family << "_bucket" << with_label(name.second, le.str()) << " " << cumulative << "\n";
+            }
+            cumulative += hist.bucket(hist.bounds().size());
+            out << family << "_bucket" << with_label(name.second, "le=\"+Inf\"") << " " << cumulative << "\n";
+            out << family << "_sum" << with_label(name.second, "") << " " << hist.sum() << "\n";
+            out << family << "_count" << with_label(name.second, "") << " " << hist.count() << "\n";
+        }
+    }
+    return out.str();
+}
+
+void MetricsRegistry::write_prometheus(const std::string &path) const
+{
+    std::string text = prometheus();
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "w");
+    if (!f)
+        throw std::runtime_error("Cannot write " + tmp + ": " + strerror(errno));
+    bool ok = fwrite(text.data(), 1, text.size(), f) == text.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+        throw std::runtime_error("Cannot write " + path + ": " + strerror(errno));
+}
+
+void MetricsRegistry::serve(const std::string &socket_path)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socket_path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("Socket path too long: " + socket_path);
+    strcpy(addr.sun_path, socket_path.c_str());
+
+    int sock = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sock == -1)
+        throw std::runtime_error(std::string("socket: ") + strerror(errno));
+    unlink(socket_path.c_str());
+    if (bind(sock, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == -1 || listen(sock, 4) == -1) {
+        int e = errno;
+        close(sock);
+        throw std::runtime_error("Cannot listen on " + socket_path + ": " + strerror(e));
+    }
+
+    std::thread([this, sock]() {
+        while (true) {
+            int fd = accept(sock, nullptr, nullptr);
+            if (fd == -1) {
+                if (errno == EINTR)
+                    continue;
+                break;
+            }
+            // A client that stalls must not block later scrapes
+            struct timeval timeout = {1, 0};
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            // The request is not interpreted, every request gets the metrics
+            char request[1024];
+            ssize_t len = recv(fd, request, sizeof(request), 0);
+            (void)len;
+            std::string body = prometheus();
+            std::string reply = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " +
+                                std::to_string(body.size()) + "\r\n\r\n" + body;
+            for (size_t sent = 0; sent < reply.size();) {
+                ssize_t n = send(fd, reply.data() + sent, reply.size() - sent, MSG_NOSIGNAL);
+                if (n <= 0)
+                    break;
+                sent += n;
+            }
+            close(fd);
+        }
+        close(sock);
+    }).detach();
+}
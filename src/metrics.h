@@ -0,0 +1,86 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/*
+ * Process-wide registry of metrics for monitoring, shared by all trackers
+ * in the process. Updates are lock-free atomic operations, so recording
+ * is cheap enough to be done on every frame. The registry is exported in
+ * the Prometheus text format, either to a file (e.g. for the node
+ * exporter's textfile collector) or over a Unix domain socket speaking
+ * minimal HTTP, which can be scraped with
+ * "curl --unix-socket <path> http://localhost/metrics".
+ *
+ * Metric names may carry Prometheus labels, e.g.
+ * kcf_stage_duration_ms{stage="detect"}; metrics sharing the name before
+ * the labels form one family with a common help text.
+ */
+class Counter {
+public:
+    void inc(uint64_t n = 1) { m_value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value{0};
+};
+
+class Histogram {
+public:
+    // bounds are the increasing upper bounds of the buckets; values above
+    // the last bound fall into the implicit +Inf bucket
+    explicit Histogram(std::vector<double> bounds);
+
+    void observe(double value);
+
+    const std::vector<double> &bounds() const { return m_bounds; }
+    uint64_t bucket(size_t i) const { return m_buckets[i].load(std::memory_order_relaxed); } // not cumulative
+    uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+    double sum() const { return m_sum.load(std::memory_order_relaxed); }
+
+    // Bucket bounds growing by factor from start
+    static std::vector<double> exponential(double start, double factor, unsigned count);
+    static std::vector<double> linear(double start, double width, unsigned count);
+
+private:
+    std::vector<double> m_bounds;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_buckets; // m_bounds.size() + 1
+    std::atomic<uint64_t> m_count{0};
+    std::atomic<double> m_sum{0};
+};
+
+class MetricsRegistry {
+public:
+    static MetricsRegistry &global();
+
+    // Return the metric of the given name, creating it on first use. The
+    // returned references stay valid for the lifetime of the process.
+    Counter &counter(const std::string &name, const std::string &help);
+    Histogram &histogram(const std::string &name, const std::string &help, const std::vector<double> &bounds);
+
+    std::string prometheus() const;
+    // Writes the text to a temporary file renamed to path, so that readers
+    // never see a partial file. Throws std::runtime_error on failure.
+    void write_prometheus(const std::string &path) const;
+    // Serves the text on a Unix domain socket from a background thread
+    void serve(const std::string &socket_path);
+
+private:
+    struct Family {
+        std::string help;
+        bool histogram;
+    };
+
+    mutable std::mutex m_mutex;
+    std::map<std::string, Family> m_families;
+    std::map<std::string, std::unique_ptr<Counter>> m_counters;
+    std::map<std::string, std::unique_ptr<Histogram>> m_histograms;
+};
+
+#endif // METRICS_H
@@ -0,0 +1,74 @@
+#include "motion.h"
+#include <cmath>
+
+void MotionModel::reset(KCF_Config::Motion type, const cv::Point2d &center, double scale, double angle)
+{
+    m_type = type;
+    m_pose = cv::Vec4d(center.x, center.y, std::log(scale), angle);
+    m_velocity = cv::Vec4d::all(0);
+    m_have_velocity = false;
+
+    if (m_type == KCF_Config::Motion::KALMAN) {
+        const int n = 4;
+        m_kalman.init(2 * n, n, 0, CV_64F);
+        // x(k+1) = x(k) + v(k)
+        cv::setIdentity(m_kalman.transitionMatrix);
+        for (int i = 0; i < n; ++i)
+            m_kalman.transitionMatrix.at<double>(i, n + i) = 1.;
+        m_kalman.measurementMatrix = cv::Mat::zeros(n, 2 * n, CV_64F);
+        cv::setIdentity(m_kalman.measurementMatrix(cv::Rect(0, 0, n, n)));
+
+        // Noise in position, log-scale and angle (degrees) units
+        m_kalman.processNoiseCov = cv::Mat::diag(
+            (cv::Mat_<double>(2 * n, 1) << 1., 1., 1e-4, 0.5, 1., 1., 1e-4, 0.5));
+        m_kalman.measurementNoiseCov = cv::Mat::diag((cv::Mat_<double>(n, 1) << 1., 1., 1e-4, 1.));
+        cv::setIdentity(m_kalman.errorCovPost, cv::Scalar::all(1.));
+        m_kalman.statePost = cv::Mat::zeros(2 * n, 1, CV_64F);
+        for (int i = 0; i < n; ++i)
+            m_kalman.statePost.at<double>(i) = m_pose[i];
+    }
+}
+
+void MotionModel::predict(cv::Point2d &center, double &scale, double &angle)
+{
+    cv::Vec4d pose;
+
+    switch (m_type) {
+    case KCF_Config::Motion::NONE:
+        return;
+    case KCF_Config::Motion::CONST_VELOCITY:
+        pose = m_pose + m_velocity;
+        break;
+    case KCF_Config::Motion::KALMAN: {
+        const cv::Mat &state = m_kalman.predict();
+        for (int i = 0; i < 4; ++i)
+            pose[i] = state.at<double>(i);
+        break;
+    }
+    }
+
+    center = cv::Point2d(pose[0], pose[1]);
+    scale = std::exp(pose[2]);
+    angle = pose[3];
+}
+
+void MotionModel::correct(const cv::Point2d &center, double scale, double angle)
+{
+    cv::Vec4d pose(center.x, center.y, std::log(scale), angle);
+
+    switch (m_type) {
+    case KCF_Config::Motion::NONE:
+        break;
+    case KCF_Config::Motion::CONST_VELOCITY:
+        if (m_have_velocity)
+            m_velocity += velocity_smoothing * ((pose - m_pose) - m_velocity);
+        else
+            m_velocity = pose - m_pose;
+        m_have_velocity = true;
+        break;
+    case KCF_Config::Motion::KALMAN:
+        m_kalman.correct(cv::Mat(pose));
+        break;
+    }
+    m_pose = pose;
+}
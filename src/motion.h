@@ -0,0 +1,37 @@
+#ifndef MOTION_H
+#define MOTION_H
+
+#include <opencv2/opencv.hpp>
+#include "kcf_config.h"
+
+/*
+ * Motion model predicting the pose (centre, scale and angle) of the
+ * tracked object in the next frame. The search window is centred at the
+ * predicted pose, which allows to handle fast motion with smaller
+ * padding.
+ */
+class MotionModel
+{
+public:
+    void reset(KCF_Config::Motion type, const cv::Point2d &center, double scale, double angle);
+    // Predicts the pose in the next frame from the previous measurements
+    void predict(cv::Point2d &center, double &scale, double &angle);
+    // Updates the model with the pose measured by the tracker
+    void correct(const cv::Point2d &center, double scale, double angle);
+
+    KCF_Config::Motion type() const { return m_type; }
+
+private:
+    static constexpr double velocity_smoothing = 0.5; // weight of the newest velocity sample
+
+    KCF_Config::Motion m_type = KCF_Config::Motion::NONE;
+
+    // Constant velocity model (scale is modelled in log space)
+    cv::Vec4d m_pose, m_velocity;
+    bool m_have_velocity = false;
+
+    // Kalman filter with state [x y log(s) a vx vy vs va]
+    cv::KalmanFilter m_kalman;
+};
+
+#endif // MOTION_H
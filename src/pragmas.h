@@ -1,20 +1,17 @@
 #ifndef PRAGMAS_H
 #define PRAGMAS_H
 
-#if defined(BIG_BATCH) && defined(OPENMP)
-#define BIG_BATCH_OMP_PARALLEL_FOR _Pragma("omp parallel for ordered")
-#define BIG_BATCH_OMP_ORDERED _Pragma("omp ordered")
-#define NORMAL_OMP_PARALLEL_FOR
-#define NORMAL_OMP_CRITICAL
-#elif defined(OPENMP)
-#define BIG_BATCH_OMP_PARALLEL_FOR
-#define BIG_BATCH_OMP_ORDERED
-#define NORMAL_OMP_PARALLEL_FOR _Pragma("omp parallel for schedule(dynamic)")
+#define DO_PRAGMA(x) _Pragma(#x)
+
+// The *_IF variants parallelize only when cond is true at run time.
+// CONTEXTS_* parallelize the evaluation of scale/angle contexts.
+#if defined(OPENMP)
+#define CONTEXTS_OMP_PARALLEL_FOR _Pragma("omp parallel for schedule(dynamic)")
+#define CONTEXTS_OMP_PARALLEL_FOR_IF(cond) DO_PRAGMA(omp parallel for schedule(dynamic) if(cond))
 #define NORMAL_OMP_CRITICAL _Pragma("omp critical")
 #else
-#define BIG_BATCH_OMP_PARALLEL_FOR
-#define BIG_BATCH_OMP_ORDERED
-#define NORMAL_OMP_PARALLEL_FOR
+#define CONTEXTS_OMP_PARALLEL_FOR
+#define CONTEXTS_OMP_PARALLEL_FOR_IF(cond)
 #define NORMAL_OMP_CRITICAL
 #endif
 
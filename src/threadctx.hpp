@@ -27,41 +27,33 @@ private:
 
 struct ThreadCtx {
   public:
-    ThreadCtx(cv::Size roi, uint num_features
-#ifdef BIG_BATCH
-              , const std::vector<double> &scales
-              , const std::vector<double> &angles
-#else
-              , double scale
-              , double angle
-#endif
-             )
+    // Evaluates the given scale and angle combinations, whose responses
+    // are transformed back by one inverse() call. The tracker uses one
+    // ThreadCtx per combination.
+    ThreadCtx(cv::Size roi, uint num_features, const std::vector<double> &scales, const std::vector<double> &angles)
         : roi(roi)
         , num_features(num_features)
-        , num_scales(IF_BIG_BATCH(scales.size(), 1))
-        , num_angles(IF_BIG_BATCH(angles.size(), 1))
-#ifdef BIG_BATCH
+        , num_scales(scales.size())
+        , num_angles(angles.size())
         , max(scales, angles)
         , dbg_patch(scales, angles)
         {
-            max.resize(scales.size() * angles.size());
-            dbg_patch.resize(scales.size() * angles.size());
-        }
-#else
-        , scale(scale)
-        , angle(angle)
-        {
-            cv::Mat patch_feat{ 4, std::vector<int>({ int(num_scales * num_angles), int(num_features), roi.height, roi.width}).data(), CV_32F};
-            cv::Mat tmp{ 4, std::vector<int>({ int(num_scales * num_angles), int(num_features), roi.height, roi.width}).data(), CV_32F};
-            cv::Mat zf_Tmp = cv::Mat::zeros((int) freq_size.height, (int) freq_size.width, CV_32FC(num_features*2));
-            cv::Mat resp = cv::Mat::zeros(3, std::vector<int>({int(num_scales * num_angles), (int) roi.height, (int) roi.width}).data(), CV_32F);
-            patch_feats = patch_feat.getUMat(cv::ACCESS_RW);
+            const uint n = num_scales * num_angles;
+            max.resize(n);
+            dbg_patch.resize(n);
+            for (uint i = 0; i < n; ++i) {
+                cv::Mat patch_feat{ 4, std::vector<int>({ 1, int(num_features), roi.height, roi.width}).data(), CV_32F};
+                cv::Mat zf_Tmp = cv::Mat::zeros((int) freq_size.height, (int) freq_size.width, CV_32FC(num_features*2));
+                patch_feats.push_back(patch_feat.getUMat(cv::ACCESS_RW));
+                zf.push_back(zf_Tmp.getUMat(cv::ACCESS_RW));
+            }
+            cv::Mat tmp{ 4, std::vector<int>({ 1, int(num_features), roi.height, roi.width}).data(), CV_32F};
+            cv::Mat kzf_Tmp = cv::Mat::zeros((int) freq_size.height, (int) freq_size.width, CV_32FC(n * 2));
+            cv::Mat resp = cv::Mat::zeros(3, std::vector<int>({int(n), (int) roi.height, (int) roi.width}).data(), CV_32F);
             temp = tmp.getUMat(cv::ACCESS_RW);
-            zf = zf_Tmp.getUMat(cv::ACCESS_RW);
+            kzf = kzf_Tmp.getUMat(cv::ACCESS_RW);
             response = resp.getUMat(cv::ACCESS_RW);
         }
-#endif
-
 
     ThreadCtx(ThreadCtx &&) = default;
 
@@ -73,34 +65,32 @@ private:
     uint num_angles;
     cv::Size freq_size = Fft::freq_size(roi);
 
-    cv::UMat patch_feats;
+    std::vector<cv::UMat> patch_feats; // {1, num_features, H, W} per context
     cv::UMat temp;
-    cv::UMat zf;
-    cv::UMat kzf = cv::UMat::zeros((int) freq_size.height, (int) freq_size.width, CV_32FC2);
-    
-    KCF_Tracker::GaussianCorrelation gaussian_correlation{num_scales * num_angles, num_features, roi};
-    
-    
+    std::vector<cv::UMat> zf;
+    cv::UMat kzf_ctx = cv::UMat::zeros((int) freq_size.height, (int) freq_size.width, CV_32FC2);
+    cv::UMat kzf; // one complex channel per context
+
+    KCF_Tracker::GaussianCorrelation gaussian_correlation{1, num_features, roi};
+
 public:
 #ifdef ASYNC
     std::future<void> async_res;
 #endif
 
-    cv::UMat response;
+    cv::UMat response; // one plane per context
+    cv::UMat &spectrum(uint idx) { return zf[idx]; } // windowed features in the Fourier domain
 
     struct Max {
         cv::Point2i loc;
         double response;
+        double psr;           // peak-to-sidelobe ratio
+        cv::Point2d subpixel; // sub-pixel offset of the peak from loc
+        bool valid = false;   // evaluated in the current frame
     };
 
-#ifdef BIG_BATCH
     ScaleRotVector<Max> max;
     ScaleRotVector<cv::Mat> dbg_patch; // images for visual debugging
-#else
-    Max max;
-    const double scale, angle;
-    cv::Mat dbg_patch; // image for visual debugging
-#endif
 };
 
 #endif // SCALE_VARS_HPP
@@ -1,5 +1,8 @@
 #include "videoio.hpp"
+#include <cstring>
 #include <iostream>
+#include <chrono>
+#include <thread>
 
 
 FileIO::FileIO(std::string video_in)
@@ -80,3 +83,186 @@ int FileIO::getImageNum() const
 {
     return num;
 }
+
+ShmIO::ShmIO(const std::string &name, bool latest)
+    : latest(latest)
+{
+    // The producer may still be starting
+    for (int attempt = 0; ; ++attempt) {
+        try {
+            shm = SharedMemory::open(name, true);
+            ring = static_cast<ShmRing *>(shm.data());
+            if (shm.size() >= sizeof(ShmRing) && ring->magic.load(std::memory_order_acquire) == ShmRing::magic_value)
+                break;
+        } catch (std::runtime_error &e) {
+            if (attempt == 50)
+                throw;
+        }
+        if (attempt == 50)
+            throw std::runtime_error("Shared memory " + name + " is not a frame ring");
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    if (ring->version != ShmRing::version_value || shm.size() < ring->total_size())
+        throw std::runtime_error("Incompatible frame ring " + name);
+
+    next = ring->read_seq.load();
+    ring->consumer_attached.store(1);
+}
+
+ShmIO::~ShmIO()
+{
+    ring->read_seq.store(next);
+    ring->consumer_attached.store(0);
+}
+
+cv::Rect ShmIO::getInitRectangle()
+{
+    if (getImageNum() > 1)
+        return cv::Rect();
+    return cv::Rect(ring->init_rect[0], ring->init_rect[1], ring->init_rect[2], ring->init_rect[3]);
+}
+
+void ShmIO::outputBoundingBox(const cv::Rect &bbox)
+{
+    (void)bbox;
+}
+
+int ShmIO::getNextFileName(char *fName)
+{
+    (void)fName;
+    return 0;
+}
+
+int ShmIO::getNextImage(cv::Mat &img)
+{
+    img.release();
+    // Release the previously returned frame to the producer
+    if (num > 0)
+        ring->read_seq.store(next, std::memory_order_release);
+
+    uint64_t written;
+    while ((written = ring->write_seq.load(std::memory_order_acquire)) <= next) {
+        if (ring->closed.load(std::memory_order_acquire) && ring->write_seq.load() <= next)
+            return 0;
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+    if (latest && written - 1 > next) {
+        ring->skipped.fetch_add(written - 1 - next);
+        next = written - 1;
+        ring->read_seq.store(next, std::memory_order_release);
+    }
+
+    // The producer does not touch the slot until read_seq passes it, so
+    // a torn frame indicates a protocol violation.
+    if (ring->slot(next).seq.load(std::memory_order_acquire) != 2 * next + 2)
+        throw std::runtime_error("Frame ring: slot overwritten by the producer");
+
+    img = cv::Mat(ring->height, ring->width, ring->type, ring->pixels(next), ring->step);
+    next++;
+    num++;
+    return 1;
+}
+
+int ShmIO::getNextImage(cv::UMat &img)
+{
+    img.release();
+    int ret = getNextImage(frame);
+    if (ret == 1)
+        img = frame.getUMat(cv::ACCESS_RW);
+    return ret;
+}
+
+int ShmIO::getImageNum() const
+{
+    return num;
+}
+
+ReplayIO::ReplayIO(const std::string &name)
+{
+    file = fopen(name.c_str(), "rb");
+    if (!file)
+        throw std::runtime_error("Cannot open recording '" + name + "'");
+    if (fread(&header, sizeof(header), 1, file) != 1 || strcmp(header.magic, "KCFREC1") != 0) {
+        fclose(file);
+        throw std::runtime_error("'" + name + "' is not a tracker recording");
+    }
+}
+
+ReplayIO::~ReplayIO()
+{
+    fclose(file);
+}
+
+bool ReplayIO::readChunk()
+{
+    RecordingChunk c;
+    if (fread(&c, sizeof(c), 1, file) != 1)
+        return false;
+    if (c.magic != RecordingChunk::magic_value)
+        throw std::runtime_error("Corrupted recording");
+    chunk.resize(c.bytes);
+    if (fread(chunk.data(), 1, c.bytes, file) != c.bytes)
+        throw std::runtime_error("Truncated recording");
+    pos = 0;
+    return true;
+}
+
+cv::Rect ReplayIO::getInitRectangle()
+{
+    return init;
+}
+
+void ReplayIO::outputBoundingBox(const cv::Rect &bbox)
+{
+    (void)bbox;
+}
+
+int ReplayIO::getNextFileName(char *fName)
+{
+    (void)fName;
+    return 0;
+}
+
+int ReplayIO::getNextImage(cv::Mat &img)
+{
+    if (pos == chunk.size() && !readChunk())
+        return 0;
+
+    RecordingFrame f;
+    if (pos + sizeof(f) > chunk.size())
+        throw std::runtime_error("Corrupted recording");
+    memcpy(&f, &chunk[pos], sizeof(f));
+    pos += sizeof(f);
+
+    // A new image for every frame, so that nothing drawn into the
+    // previous one by the caller shows through
+    cv::Mat out = cv::Mat::zeros(header.height, header.width, header.type);
+    init = cv::Rect(f.init[0], f.init[1], f.init[2], f.init[3]);
+    cv::Rect crop(f.crop[0], f.crop[1], f.crop[2], f.crop[3]);
+    if ((crop & cv::Rect(0, 0, out.cols, out.rows)) != crop)
+        throw std::runtime_error("Corrupted recording");
+
+    size_t row_bytes = crop.width * out.elemSize();
+    if (pos + row_bytes * crop.height > chunk.size())
+        throw std::runtime_error("Corrupted recording");
+    for (int y = crop.y; y < crop.y + crop.height; ++y, pos += row_bytes)
+        memcpy(out.ptr(y, crop.x), &chunk[pos], row_bytes);
+
+    img = out;
+    num++;
+    return 1;
+}
+
+int ReplayIO::getNextImage(cv::UMat &img)
+{
+    img.release();
+    int ret = getNextImage(frame);
+    if (ret == 1)
+        img = frame.getUMat(cv::ACCESS_RW);
+    return ret;
+}
+
+int ReplayIO::getImageNum() const
+{
+    return num;
+}
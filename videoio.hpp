@@ -4,6 +4,9 @@
 #include <opencv2/opencv.hpp>
 #include <fstream>
 #include <string>
+#include "shmem.hpp"
+#include "shm_ring.hpp"
+#include "recording.hpp"
 
 class VideoIO {
 public:
@@ -36,4 +39,62 @@ private:
     std::string rect_line;
 };
 
+// Reads frames from a shared memory ring written by kcf_shm_producer (see
+// shm_ring.hpp). The returned images refer to the shared buffer, they are
+// valid until the next call of getNextImage().
+class ShmIO : public VideoIO {
+public:
+    // With latest == true, frames waiting in the ring are skipped and only
+    // the newest one is returned.
+    ShmIO(const std::string &name, bool latest = false);
+    ~ShmIO() override;
+
+    cv::Rect getInitRectangle() override;
+    void outputBoundingBox(const cv::Rect & bbox) override;
+    int getNextFileName(char * fName) override;
+    int getNextImage(cv::UMat &img) override;
+    int getNextImage(cv::Mat & img) override;
+    int getImageNum() const override;
+
+    // Frames dropped by the producer because the ring was full
+    uint64_t getDropped() const { return ring->dropped.load(); }
+    // Frames skipped by this consumer in the latest mode
+    uint64_t getSkipped() const { return ring->skipped.load(); }
+
+private:
+    SharedMemory shm;
+    ShmRing *ring;
+    bool latest;
+    cv::Mat frame; // backs the UMat returned by getNextImage()
+    uint64_t next = 0;
+    int num = 0;
+};
+
+// Replays frames recorded by kcf_vot --record (see recording.hpp). Only
+// the recorded parts of the frames are valid, the rest is zero.
+class ReplayIO : public VideoIO {
+public:
+    ReplayIO(const std::string &file);
+    ~ReplayIO() override;
+
+    // The rectangle recorded for the current frame
+    cv::Rect getInitRectangle() override;
+    void outputBoundingBox(const cv::Rect & bbox) override;
+    int getNextFileName(char * fName) override;
+    int getNextImage(cv::UMat &img) override;
+    int getNextImage(cv::Mat & img) override;
+    int getImageNum() const override;
+
+private:
+    bool readChunk();
+
+    FILE *file;
+    RecordingHeader header;
+    std::vector<char> chunk;
+    size_t pos = 0;
+    cv::Mat frame; // backs the UMat returned by getNextImage()
+    cv::Rect init;
+    int num = 0;
+};
+
 #endif // VIDEOIO_HPP
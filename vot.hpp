@@ -33,9 +33,13 @@ typedef struct {
 class VOT : public VideoIO
 {
 public:
-    VOT(const std::string & region_file, const std::string & images, const std::string & ouput)
+    // Relative image paths listed in 'images' are resolved against
+    // base_dir, the current directory by default.
+    VOT(const std::string & region_file, const std::string & images, const std::string & ouput,
+        const std::string & base_dir = "")
     {
         _images = images;
+        _base_dir = base_dir.empty() || base_dir.back() == '/' ? base_dir : base_dir + "/";
         p_region_stream.open(region_file.c_str());
         VOTPolygon p;
         if (p_region_stream.is_open()){
@@ -97,9 +101,12 @@ public:
         if (!p_images_stream.is_open())
             std::cerr << "Error loading image file " << images << "!" << std::endl;
 
-        p_output_stream.open(ouput.c_str());
-        if (!p_output_stream.is_open())
-            std::cerr << "Error opening output file " << ouput << "!" << std::endl;
+        // Empty output name means that boxes are stored elsewhere (see result_sink.hpp)
+        if (!ouput.empty()) {
+            p_output_stream.open(ouput.c_str());
+            if (!p_output_stream.is_open())
+                std::cerr << "Error opening output file " << ouput << "!" << std::endl;
+        }
         p_region_stream.close();
     }
 
@@ -130,7 +137,7 @@ public:
     inline void outputBoundingBox(const cv::Rect & bbox) override
     {
         p_output_stream << bbox.x << "," << bbox.y << ",";
-        p_output_stream << bbox.width << "," << bbox.height << std::endl;
+        p_output_stream << bbox.width << "," << bbox.height << "\n";
     }
 
     inline void outputPolygon(const VOTPolygon & poly)
@@ -138,7 +145,7 @@ public:
       p_output_stream << poly.x1 << "," << poly.y1 << ",";
       p_output_stream << poly.x2 << "," << poly.y2 << ",";
       p_output_stream << poly.x3 << "," << poly.y3 << ",";
-      p_output_stream << poly.x4 << "," << poly.y4 << std::endl;
+      p_output_stream << poly.x4 << "," << poly.y4 << "\n";
     }
 
     inline int getNextFileName(char * fName) override
@@ -159,7 +166,7 @@ public:
         std::string line;
         std::getline (p_images_stream, line);
     	if (line.empty() && p_images_stream.eof()) return -1;
-        img = cv::imread(line, cv::IMREAD_COLOR);
+        img = cv::imread(imagePath(line), cv::IMREAD_COLOR);
         num++;
 
         return 1;
@@ -173,7 +180,7 @@ public:
         std::string line;
         std::getline (p_images_stream, line);
     	if (line.empty() && p_images_stream.eof()) return -1;
-        img = cv::imread(line, cv::IMREAD_COLOR).getUMat(cv::ACCESS_RW);
+        img = cv::imread(imagePath(line), cv::IMREAD_COLOR).getUMat(cv::ACCESS_RW);
         num++;
 
         return 1;
@@ -186,7 +193,13 @@ public:
 
 
 private:
+    std::string imagePath(const std::string & line) const
+    {
+        return line.empty() || line[0] == '/' ? line : _base_dir + line;
+    }
+
     std::string _images;
+    std::string _base_dir;
     VOTPolygon p_init_polygon;
     std::ifstream p_region_stream;
     std::ifstream p_images_stream;
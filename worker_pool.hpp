@@ -0,0 +1,76 @@
+#ifndef WORKER_POOL_HPP
+#define WORKER_POOL_HPP
+
+#include <algorithm>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+/*
+ * Fixed set of threads executing submitted jobs in FIFO order. Shared by
+ * all streams of the tracking daemon, so that the number of threads does
+ * not grow with the number of tracked objects.
+ */
+class WorkerPool {
+public:
+    explicit WorkerPool(unsigned threads)
+    {
+        for (unsigned i = 0; i < std::max(threads, 1u); ++i)
+            m_threads.emplace_back([this] { run(); });
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_stop = true;
+        }
+        m_cond.notify_all();
+        for (auto &t : m_threads)
+            t.join();
+    }
+
+    // Exceptions thrown by the job are rethrown by the future's get()
+    std::future<void> submit(std::function<void()> job)
+    {
+        std::packaged_task<void()> task(std::move(job));
+        std::future<void> result = task.get_future();
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_jobs.push(std::move(task));
+        }
+        m_cond.notify_one();
+        return result;
+    }
+
+    unsigned size() const { return m_threads.size(); }
+
+private:
+    void run()
+    {
+        while (true) {
+            std::packaged_task<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_cond.wait(lock, [this] { return m_stop || !m_jobs.empty(); });
+                if (m_jobs.empty())
+                    return;
+                task = std::move(m_jobs.front());
+                m_jobs.pop();
+            }
+            task();
+        }
+    }
+
+    std::vector<std::thread> m_threads;
+    std::queue<std::packaged_task<void()>> m_jobs;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+    bool m_stop = false;
+};
+
+#endif // WORKER_POOL_HPP